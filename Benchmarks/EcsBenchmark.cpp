@@ -0,0 +1,364 @@
+/*
+	ECS storage benchmarks.
+	Creates, destroys, looks up and iterates 10^3 to 10^7 entities through Scene and ComponentContainer, with both
+	the hashed and sparse component indices, and writes ns/op (and memory per entity) as json - run it before and
+	after a storage change to Entities.h to compare.
+	The hashed index's chains grow with the number of components, so it's only run up to --max-hashed-entities.
+
+	Usage: EcsBenchmark [--repetitions N] [--max-entities N] [--max-hashed-entities N] [--output file.json]
+*/
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <Psapi.h>
+#pragma comment(lib, "psapi.lib")
+
+#include "External/json.hpp"
+#include "ECS/Entities.h"
+#include "ECS/View.h"
+
+using namespace rkg;
+using namespace rkg::ecs;
+using nlohmann::json;
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	struct Options
+	{
+		int repetitions{ 5 };
+		size_t max_entities{ 10000000 };
+		size_t max_hashed_entities{ 100000 };
+		const char* output_path{ nullptr };
+	};
+
+	struct Position : Component
+	{
+		Vec3 value;
+	};
+
+	struct Velocity : Component
+	{
+		Vec3 value;
+	};
+
+	//Only on some entities, so joins have something to skip.
+	struct Health : Component
+	{
+		float value;
+	};
+	constexpr size_t HEALTH_EVERY{ 10 };
+
+	uint64_t NanosecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+	}
+
+	//Private bytes of the whole process.
+	size_t GetMemoryUsage()
+	{
+		PROCESS_MEMORY_COUNTERS_EX counters;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters), sizeof(counters))) {
+			return 0;
+		}
+		return counters.PrivateUsage;
+	}
+
+	//Keeps results alive, so the compiler can't throw the work away.
+	volatile float result_sink{ 0.0f };
+
+	template<typename Index>
+	struct World
+	{
+		Scene scene;
+		ComponentContainer<Position, Index> positions;
+		ComponentContainer<Velocity, Index> velocities;
+		ComponentContainer<Health, Index> healths;
+		std::vector<EntityID> ids;
+
+		void Spawn(size_t i)
+		{
+			const EntityID id = scene.CreateEntity()->id;
+			positions.Create(id)->value = Vec3(float(i), 0.0f, 0.0f);
+			velocities.Create(id)->value = Vec3(1.0f, 0.0f, 0.0f);
+			if (i % HEALTH_EVERY == 0) {
+				healths.Create(id)->value = 100.0f;
+			}
+			ids.push_back(id);
+		}
+
+		void Despawn(EntityID id)
+		{
+			positions.Remove(id);
+			velocities.Remove(id);
+			healths.Remove(id);
+			scene.DestroyEntity(id);
+		}
+
+		void Populate(size_t count)
+		{
+			ids.reserve(count);
+			for (size_t i = 0; i < count; i++) {
+				Spawn(i);
+			}
+		}
+	};
+
+	std::vector<EntityID> Shuffled(std::vector<EntityID> ids)
+	{
+		std::mt19937 rng(1234);
+		std::shuffle(ids.begin(), ids.end(), rng);
+		return ids;
+	}
+
+	/*
+		Runs the benchmark once to warm up, then the given number of times. The benchmark function does its own
+		setup and returns the time taken in nanoseconds by the part being measured, which does ops operations.
+	*/
+	template<typename T>
+	json Measure(const Options& options, const char* name, json parameters, size_t ops, T&& benchmark)
+	{
+		benchmark();
+
+		std::vector<uint64_t> times;
+		for (int i = 0; i < options.repetitions; i++) {
+			times.push_back(benchmark());
+		}
+		std::sort(times.begin(), times.end());
+
+		const double median = static_cast<double>(times[times.size() / 2]);
+		json result = {
+			{ "benchmark", name },
+			{ "parameters", parameters },
+			{ "repetitions", options.repetitions },
+			{ "ops", ops },
+			{ "min_ms", times.front() / 1e6 },
+			{ "median_ms", median / 1e6 },
+			{ "max_ms", times.back() / 1e6 },
+			{ "median_ns_per_op", median / ops },
+		};
+
+		std::cerr << name << " " << parameters.dump() << ": " << result["median_ns_per_op"].get<double>() << " ns/op\n";
+		return result;
+	}
+
+	//Entities with a Position and Velocity, and a Health on every 10th.
+	template<typename Index>
+	uint64_t Create(size_t count)
+	{
+		World<Index> world;
+		world.ids.reserve(count);
+		const auto start = Clock::now();
+		for (size_t i = 0; i < count; i++) {
+			world.Spawn(i);
+		}
+		return NanosecondsSince(start);
+	}
+
+	//Removes every component and entity, in random order.
+	template<typename Index>
+	uint64_t Destroy(size_t count)
+	{
+		World<Index> world;
+		world.Populate(count);
+		const auto order = Shuffled(world.ids);
+		const auto start = Clock::now();
+		for (auto id : order) {
+			world.Despawn(id);
+		}
+		return NanosecondsSince(start);
+	}
+
+	//Get on every entity, either in the order they were made (mostly walks memory in order) or shuffled.
+	template<typename Index>
+	uint64_t Lookup(World<Index>& world, bool random)
+	{
+		auto& positions = world.positions;
+		const auto order = random ? Shuffled(world.ids) : world.ids;
+		float sum = 0.0f;
+		const auto start = Clock::now();
+		for (auto id : order) {
+			sum += positions.Get(id)->value.x;
+		}
+		const uint64_t time = NanosecondsSince(start);
+		result_sink = sum;
+		return time;
+	}
+
+	//Integrates position += velocity over the packed arrays. Both were filled in the same order, so they line up.
+	template<typename Index>
+	uint64_t Iterate(World<Index>& world)
+	{
+		const auto start = Clock::now();
+		const size_t count = world.positions.Size();
+		for (size_t i = 0; i < count; i++) {
+			auto& p = world.positions.At(i);
+			p.value += world.velocities.At(i).value;
+		}
+		return NanosecondsSince(start);
+	}
+
+	//View over all three containers - driven by the rare Health, looking up the other two.
+	template<typename Index>
+	uint64_t Join(World<Index>& world)
+	{
+		float sum = 0.0f;
+		auto view = MakeView(world.positions, world.velocities, world.healths);
+		const auto start = Clock::now();
+		view.ForEach([&sum](Position& p, Velocity& v, Health& h) {
+			sum += p.value.x + v.value.x + h.value;
+		});
+		const uint64_t time = NanosecondsSince(start);
+		result_sink = sum;
+		return time;
+	}
+
+	//Same, with two common components, so every entity matches.
+	template<typename Index>
+	uint64_t Join2(World<Index>& world)
+	{
+		float sum = 0.0f;
+		auto view = MakeView(world.positions, world.velocities);
+		const auto start = Clock::now();
+		view.ForEach([&sum](Position& p, Velocity& v) {
+			sum += p.value.x + v.value.x;
+		});
+		const uint64_t time = NanosecondsSince(start);
+		result_sink = sum;
+		return time;
+	}
+
+	//Steady state turnover - each op destroys a random entity and makes a new one, so indices get recycled.
+	template<typename Index>
+	uint64_t Churn(size_t count)
+	{
+		World<Index> world;
+		world.Populate(count);
+		std::mt19937 rng(42);
+		std::vector<size_t> victims(count);
+		for (auto& v : victims) {
+			v = rng() % count;
+		}
+		const auto start = Clock::now();
+		for (size_t i = 0; i < count; i++) {
+			const size_t victim = victims[i];
+			world.Despawn(world.ids[victim]);
+			world.Spawn(i);
+			world.ids[victim] = world.ids.back();
+			world.ids.pop_back();
+		}
+		return NanosecondsSince(start);
+	}
+
+	//Process memory growth from populating a world, per entity. Approximate - the heap may reuse memory freed by
+	//earlier benchmarks, which is why sizes are run smallest first.
+	template<typename Index>
+	json MeasureMemory(size_t count, const char* storage)
+	{
+		const size_t before = GetMemoryUsage();
+		size_t after = 0;
+		{
+			World<Index> world;
+			world.Populate(count);
+			after = GetMemoryUsage();
+		}
+		const double per_entity = after > before ? double(after - before) / count : 0.0;
+		std::cerr << "memory {\"entities\":" << count << ",\"storage\":\"" << storage << "\"}: " << per_entity << " bytes/entity\n";
+		return {
+			{ "benchmark", "memory" },
+			{ "parameters", { { "entities", count }, { "storage", storage } } },
+			{ "bytes", after > before ? after - before : 0 },
+			{ "bytes_per_entity", per_entity },
+		};
+	}
+
+	template<typename Index>
+	void RunStorageBenchmarks(const Options& options, size_t count, const char* storage, json& results)
+	{
+		const json parameters = { { "entities", count }, { "storage", storage } };
+
+		results.push_back(MeasureMemory<Index>(count, storage));
+		results.push_back(Measure(options, "create", parameters, count, [=]() { return Create<Index>(count); }));
+		results.push_back(Measure(options, "destroy", parameters, count, [=]() { return Destroy<Index>(count); }));
+		results.push_back(Measure(options, "churn", parameters, count, [=]() { return Churn<Index>(count); }));
+
+		//These only read (or write component values), so share one world.
+		World<Index> world;
+		world.Populate(count);
+		results.push_back(Measure(options, "get_sequential", parameters, count, [&]() { return Lookup(world, false); }));
+		results.push_back(Measure(options, "get_random", parameters, count, [&]() { return Lookup(world, true); }));
+		results.push_back(Measure(options, "iterate", parameters, count, [&]() { return Iterate(world); }));
+		results.push_back(Measure(options, "join_2", parameters, count, [&]() { return Join2(world); }));
+		results.push_back(Measure(options, "join_3", parameters, world.healths.Size(), [&]() { return Join(world); }));
+	}
+
+	json RunBenchmarks(const Options& options)
+	{
+		json results = json::array();
+		for (size_t count = 1000; count <= options.max_entities; count *= 10) {
+			RunStorageBenchmarks<SparseComponentIndex>(options, count, "sparse", results);
+			if (count <= options.max_hashed_entities) {
+				RunStorageBenchmarks<HashedComponentIndex>(options, count, "hashed", results);
+			}
+		}
+		return results;
+	}
+
+	Options ParseOptions(int argc, char** argv)
+	{
+		Options options;
+		for (int i = 1; i < argc; i++) {
+			const bool has_value = i + 1 < argc;
+			if (has_value && strcmp(argv[i], "--repetitions") == 0) {
+				options.repetitions = std::max(atoi(argv[++i]), 1);
+			}
+			else if (has_value && strcmp(argv[i], "--max-entities") == 0) {
+				options.max_entities = std::min<size_t>(strtoull(argv[++i], nullptr, 10), MAX_ENTITIES);
+			}
+			else if (has_value && strcmp(argv[i], "--max-hashed-entities") == 0) {
+				options.max_hashed_entities = strtoull(argv[++i], nullptr, 10);
+			}
+			else if (has_value && strcmp(argv[i], "--output") == 0) {
+				options.output_path = argv[++i];
+			}
+			else {
+				std::cerr << "Usage: " << argv[0] << " [--repetitions N] [--max-entities N] [--max-hashed-entities N] [--output file.json]\n";
+				exit(EXIT_FAILURE);
+			}
+		}
+		return options;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const Options options = ParseOptions(argc, argv);
+
+	json output = {
+		{ "component_sizes", { { "position", sizeof(Position) }, { "velocity", sizeof(Velocity) }, { "health", sizeof(Health) } } },
+		{ "results", RunBenchmarks(options) },
+	};
+
+	if (options.output_path) {
+		std::ofstream file(options.output_path);
+		file << output.dump(2) << "\n";
+	}
+	else {
+		std::cout << output.dump(2) << "\n";
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,350 @@
+/*
+	Job system benchmarks.
+	Runs every benchmark with 1 to N threads (the main thread plus N-1 workers), and writes the results as json,
+	so runs before and after a scheduler change can be compared with a script.
+
+	Usage: JobSystemBenchmark [--threads N] [--repetitions N] [--max-elements N] [--fibers] [--output file.json]
+*/
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "External/json.hpp"
+#include "ECS/JobSystem.h"
+
+using namespace rkg;
+using nlohmann::json;
+
+namespace
+{
+	using Clock = std::chrono::steady_clock;
+
+	struct Options
+	{
+		int max_threads{ std::max(static_cast<int>(std::thread::hardware_concurrency()), 1) };
+		int repetitions{ 10 };
+		size_t max_elements{ 100000000 };
+		bool fibers{ false };
+		const char* output_path{ nullptr };
+	};
+
+	uint64_t NanosecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+	}
+
+	//Cheap work that the compiler can't throw away.
+	thread_local uint64_t work_sink{ 0 };
+
+	inline void DoWork(uint64_t i)
+	{
+		//splitmix64 finalizer.
+		i = (i ^ (i >> 30)) * 0xbf58476d1ce4e5b9ull;
+		i = (i ^ (i >> 27)) * 0x94d049bb133111ebull;
+		work_sink += i ^ (i >> 31);
+	}
+
+	//Totals across all threads, so each result shows how much stealing/idling it caused.
+	ecs::WorkerStats SumWorkerStats()
+	{
+		ecs::WorkerStats total{};
+		for (int i = 0; i < ecs::GetNumJobThreads(); i++) {
+			const auto stats = ecs::GetWorkerStats(i);
+			total.jobs_executed += stats.jobs_executed;
+			total.jobs_stolen += stats.jobs_stolen;
+			total.failed_steals += stats.failed_steals;
+			total.idle_ns += stats.idle_ns;
+			total.parked_ns += stats.parked_ns;
+		}
+		return total;
+	}
+
+	/*
+		Runs the benchmark once to warm up, then the given number of times. The benchmark function returns
+		the time taken in nanoseconds, so it can leave setup out of the measurement. ClearJobs is called
+		after every run, outside of the measurement.
+	*/
+	template<typename T>
+	json Measure(const Options& options, const char* name, json parameters, T&& benchmark)
+	{
+		benchmark();
+		ecs::ClearJobs();
+
+		std::vector<uint64_t> times;
+		const auto stats_before = SumWorkerStats();
+		for (int i = 0; i < options.repetitions; i++) {
+			times.push_back(benchmark());
+			ecs::ClearJobs();
+		}
+		const auto stats_after = SumWorkerStats();
+		std::sort(times.begin(), times.end());
+
+		uint64_t total_time = 0;
+		for (auto t : times) {
+			total_time += t;
+		}
+
+		const double repetitions = static_cast<double>(options.repetitions);
+		json result = {
+			{ "benchmark", name },
+			{ "threads", ecs::GetNumJobThreads() },
+			{ "parameters", parameters },
+			{ "repetitions", options.repetitions },
+			{ "min_ms", times.front() / 1e6 },
+			{ "median_ms", times[times.size() / 2] / 1e6 },
+			{ "mean_ms", total_time / repetitions / 1e6 },
+			{ "max_ms", times.back() / 1e6 },
+			{ "jobs_executed", (stats_after.jobs_executed - stats_before.jobs_executed) / repetitions },
+			{ "jobs_stolen", (stats_after.jobs_stolen - stats_before.jobs_stolen) / repetitions },
+			{ "failed_steals", (stats_after.failed_steals - stats_before.failed_steals) / repetitions },
+			{ "idle_ms", (stats_after.idle_ns - stats_before.idle_ns) / repetitions / 1e6 },
+		};
+
+		std::cerr << name << " " << parameters.dump() << " threads " << ecs::GetNumJobThreads()
+			<< ": " << result["median_ms"].get<double>() << " ms\n";
+		return result;
+	}
+
+	//Job creation, submission and scheduling overhead, with nothing else going on. All jobs are made on the main thread.
+	uint64_t EmptyJobs(size_t num_jobs)
+	{
+		const auto start = Clock::now();
+		ecs::Job* root = ecs::CreateJob([](ecs::Job*) {});
+		for (size_t i = 0; i < num_jobs; i++) {
+			ecs::SubmitJob(ecs::CreateChildJob(root, [](ecs::Job*) {}));
+		}
+		ecs::SubmitJob(root);
+		ecs::Wait(root);
+		return NanosecondsSince(start);
+	}
+
+	//Fine grained recursive jobs, joined with continuations - every job spawns more jobs.
+	void Fib(ecs::Job* j, int n, uint64_t* result)
+	{
+		if (n < 2) {
+			*result = n;
+			return;
+		}
+
+		auto partial = static_cast<uint64_t*>(ecs::AllocateJobScratch(2 * sizeof(uint64_t)));
+		ecs::Job* children[2] = {
+			ecs::CreateJob([=](ecs::Job* child) { Fib(child, n - 1, &partial[0]); }),
+			ecs::CreateJob([=](ecs::Job* child) { Fib(child, n - 2, &partial[1]); }),
+		};
+		ecs::Job* sum = ecs::CreateChildJob(j, [=](ecs::Job*) {
+			*result = partial[0] + partial[1];
+		});
+		ecs::SubmitJobAfter(sum, children, 2);
+		ecs::SubmitJob(children[0]);
+		ecs::SubmitJob(children[1]);
+	}
+
+	uint64_t FibJobs(int n)
+	{
+		uint64_t result = 0;
+		const auto start = Clock::now();
+		ecs::Job* root = ecs::CreateJob([n, &result](ecs::Job* j) { Fib(j, n, &result); });
+		ecs::SubmitJob(root);
+		ecs::Wait(root);
+		const uint64_t time = NanosecondsSince(start);
+
+		uint64_t a = 0, b = 1;
+		for (int i = 0; i < n; i++) {
+			b += a;
+			a = b - a;
+		}
+		if (result != a) {
+			std::cerr << "Fib(" << n << ") returned " << result << ", expected " << a << "\n";
+			exit(EXIT_FAILURE);
+		}
+		return time;
+	}
+
+	//Same, but joined by waiting inside the jobs - in fiber mode these suspend, otherwise they nest.
+	uint64_t FibWait(int n)
+	{
+		if (n < 2) {
+			return n;
+		}
+
+		uint64_t a = 0, b = 0;
+		ecs::Job* first = ecs::CreateJob([n, &a](ecs::Job*) { a = FibWait(n - 1); });
+		ecs::Job* second = ecs::CreateJob([n, &b](ecs::Job*) { b = FibWait(n - 2); });
+		ecs::SubmitJob(first);
+		ecs::SubmitJob(second);
+		ecs::Wait(first);
+		ecs::Wait(second);
+		return a + b;
+	}
+
+	uint64_t FibWaitJobs(int n)
+	{
+		uint64_t result = 0;
+		const auto start = Clock::now();
+		ecs::Job* root = ecs::CreateJob([n, &result](ecs::Job*) { result = FibWait(n); });
+		ecs::SubmitJob(root);
+		ecs::Wait(root);
+		return NanosecondsSince(start);
+	}
+
+	uint64_t ParallelForJobs(size_t num_elements, size_t batch_size)
+	{
+		const auto start = Clock::now();
+		ecs::Job* root = ecs::ParallelFor(num_elements, batch_size, [](size_t i) {
+			DoWork(i);
+		});
+		ecs::SubmitJob(root);
+		ecs::Wait(root);
+		return NanosecondsSince(start);
+	}
+
+	//Each job keeps three quarters of its work and splits off a quarter, all the way down, so the tree is
+	//lopsided and all the work starts out in one queue - everyone else has to steal it.
+	void ImbalancedTree(ecs::Job* j, uint64_t work, uint64_t leaf_work)
+	{
+		while (work > leaf_work) {
+			const uint64_t split = work / 4;
+			ecs::SubmitJob(ecs::CreateChildJob(j, [=](ecs::Job* child) {
+				ImbalancedTree(child, split, leaf_work);
+			}));
+			work -= split;
+		}
+
+		for (uint64_t i = 0; i < work; i++) {
+			DoWork(i);
+		}
+	}
+
+	uint64_t ImbalancedTreeJobs(uint64_t total_work, uint64_t leaf_work)
+	{
+		const auto start = Clock::now();
+		ecs::Job* root = ecs::CreateJob([=](ecs::Job* j) { ImbalancedTree(j, total_work, leaf_work); });
+		ecs::SubmitJob(root);
+		ecs::Wait(root);
+		return NanosecondsSince(start);
+	}
+
+	//Cost of the end of frame reset, after a frame which ran the given number of jobs.
+	uint64_t ClearJobsCost(size_t num_jobs)
+	{
+		EmptyJobs(num_jobs);
+		const auto start = Clock::now();
+		ecs::ClearJobs();
+		return NanosecondsSince(start);
+	}
+
+	json RunBenchmarks(const Options& options)
+	{
+		json results = json::array();
+
+		for (size_t num_jobs : { 1000, 100000, 1000000 }) {
+			results.push_back(Measure(options, "empty_jobs", { { "jobs", num_jobs } }, [=]() {
+				return EmptyJobs(num_jobs);
+			}));
+		}
+
+		for (int n : { 20, 25 }) {
+			results.push_back(Measure(options, "fib", { { "n", n } }, [=]() {
+				return FibJobs(n);
+			}));
+		}
+
+		for (int n : { 20, 25 }) {
+			results.push_back(Measure(options, "fib_wait", { { "n", n } }, [=]() {
+				return FibWaitJobs(n);
+			}));
+		}
+
+		for (size_t num_elements : { 1000000, 10000000, 100000000 }) {
+			if (num_elements > options.max_elements) {
+				continue;
+			}
+			for (size_t batch_size : { size_t(256), size_t(4096), size_t(65536), ecs::AUTO_BATCH_SIZE }) {
+				json parameters = { { "elements", num_elements }, { "batch_size", batch_size == ecs::AUTO_BATCH_SIZE ? json("auto") : json(batch_size) } };
+				results.push_back(Measure(options, "parallel_for", parameters, [=]() {
+					return ParallelForJobs(num_elements, batch_size);
+				}));
+			}
+		}
+
+		for (uint64_t leaf_work : { 1024, 16384 }) {
+			const uint64_t total_work = 1 << 24;
+			results.push_back(Measure(options, "imbalanced_tree", { { "work", total_work }, { "leaf_work", leaf_work } }, [=]() {
+				return ImbalancedTreeJobs(total_work, leaf_work);
+			}));
+		}
+
+		for (size_t num_jobs : { 1000, 100000, 1000000 }) {
+			results.push_back(Measure(options, "clear_jobs", { { "jobs", num_jobs } }, [=]() {
+				return ClearJobsCost(num_jobs);
+			}));
+		}
+
+		return results;
+	}
+
+	Options ParseOptions(int argc, char** argv)
+	{
+		Options options;
+		for (int i = 1; i < argc; i++) {
+			const bool has_value = i + 1 < argc;
+			if (has_value && strcmp(argv[i], "--threads") == 0) {
+				options.max_threads = std::max(atoi(argv[++i]), 1);
+			}
+			else if (has_value && strcmp(argv[i], "--repetitions") == 0) {
+				options.repetitions = std::max(atoi(argv[++i]), 1);
+			}
+			else if (has_value && strcmp(argv[i], "--max-elements") == 0) {
+				options.max_elements = strtoull(argv[++i], nullptr, 10);
+			}
+			else if (strcmp(argv[i], "--fibers") == 0) {
+				options.fibers = true;
+			}
+			else if (has_value && strcmp(argv[i], "--output") == 0) {
+				options.output_path = argv[++i];
+			}
+			else {
+				std::cerr << "Usage: " << argv[0] << " [--threads N] [--repetitions N] [--max-elements N] [--fibers] [--output file.json]\n";
+				exit(EXIT_FAILURE);
+			}
+		}
+		return options;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const Options options = ParseOptions(argc, argv);
+
+	json output = {
+		{ "hardware_threads", std::thread::hardware_concurrency() },
+		{ "fibers", options.fibers },
+		{ "results", json::array() },
+	};
+
+	for (int num_threads = 1; num_threads <= options.max_threads; num_threads++) {
+		ecs::InitializeWorkerThreads(num_threads - 1, options.fibers);
+		for (auto& result : RunBenchmarks(options)) {
+			output["results"].push_back(result);
+		}
+		ecs::ShutdownWorkerThreads();
+	}
+
+	if (options.output_path) {
+		std::ofstream file(options.output_path);
+		file << output.dump(2) << "\n";
+	}
+	else {
+		std::cout << output.dump(2) << "\n";
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,333 @@
+#include "Archetypes.h"
+
+#include <algorithm>
+
+namespace rkg
+{
+namespace ecs
+{
+
+void SortComponentTypes(const ComponentTypeInfo** types, size_t count)
+{
+	std::sort(types, types + count, [](const ComponentTypeInfo* a, const ComponentTypeInfo* b) { return a->id < b->id; });
+	Expects(std::adjacent_find(types, types + count) == types + count && "Entity can't have two components of the same type.");
+}
+
+uint32_t HashComponentTypes(const ComponentTypeInfo* const* types, size_t count)
+{
+	//FNV-1a over the ids.
+	uint32_t hash = hash32_val_const;
+	for (size_t i = 0; i < count; i++) {
+		hash = (hash ^ types[i]->id) * hash32_prime_const;
+	}
+	return hash;
+}
+
+Archetype::Archetype(std::vector<const ComponentTypeInfo*> types)
+	: types_{ std::move(types) }
+{
+	//Work out how many entities fit in a chunk, leaving room to align each array.
+	size_t bytes_per_entity = sizeof(EntityID);
+	for (auto type : types_) {
+		Expects(type->alignment <= ARCHETYPE_ARRAY_ALIGNMENT);
+		bytes_per_entity += type->size;
+	}
+	const size_t alignment_slack = ARCHETYPE_ARRAY_ALIGNMENT * (types_.size() + 1);
+	chunk_capacity_ = static_cast<uint32_t>((ARCHETYPE_CHUNK_SIZE - alignment_slack) / bytes_per_entity);
+	Ensures(chunk_capacity_ > 0 && "Components too large to fit in an archetype chunk.");
+
+	size_t offset = RoundToAligned(chunk_capacity_ * sizeof(EntityID), ARCHETYPE_ARRAY_ALIGNMENT);
+	for (auto type : types_) {
+		column_offsets_.push_back(static_cast<uint32_t>(offset));
+		offset = RoundToAligned(offset + chunk_capacity_ * type->size, ARCHETYPE_ARRAY_ALIGNMENT);
+	}
+	Ensures(offset <= ARCHETYPE_CHUNK_SIZE);
+}
+
+Archetype::~Archetype()
+{
+	Clear();
+}
+
+size_t Archetype::GetNumEntities() const
+{
+	if (chunks_.empty()) {
+		return 0;
+	}
+	//Only the last chunk is ever partly full.
+	return (chunks_.size() - 1) * chunk_capacity_ + chunks_.back().count;
+}
+
+int Archetype::FindColumn(ComponentTypeID id) const
+{
+	for (size_t i = 0; i < types_.size(); i++) {
+		if (types_[i]->id == id) {
+			return static_cast<int>(i);
+		}
+	}
+	return -1;
+}
+
+bool Archetype::HasAll(const ComponentTypeID* ids, int count) const
+{
+	for (int i = 0; i < count; i++) {
+		if (FindColumn(ids[i]) < 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void Archetype::PushBack(EntityID id, uint32_t* chunk_index, uint32_t* row)
+{
+	if (chunks_.empty() || chunks_.back().count == chunk_capacity_) {
+		auto block = allocator_.Allocate(ARCHETYPE_CHUNK_SIZE);
+		ASSERT(block.ptr != nullptr && "Failed to allocate archetype chunk!");
+		chunks_.push_back({ static_cast<char*>(block.ptr), 0 });
+	}
+	auto& chunk = chunks_.back();
+	*chunk_index = static_cast<uint32_t>(chunks_.size() - 1);
+	*row = chunk.count++;
+	GetEntities(chunk)[*row] = id;
+}
+
+EntityID Archetype::RemoveAndFill(uint32_t chunk_index, uint32_t row)
+{
+	auto& last_chunk = chunks_.back();
+	const uint32_t last_row = last_chunk.count - 1;
+	EntityID moved = INVALID_ENTITY;
+
+	if (chunk_index != chunks_.size() - 1 || row != last_row) {
+		auto& chunk = chunks_[chunk_index];
+		for (size_t i = 0; i < types_.size(); i++) {
+			types_[i]->move(GetComponent(chunk, static_cast<int>(i), row), GetComponent(last_chunk, static_cast<int>(i), last_row));
+		}
+		moved = GetEntities(last_chunk)[last_row];
+		GetEntities(chunk)[row] = moved;
+	}
+
+	if (--last_chunk.count == 0) {
+		allocator_.Deallocate({ last_chunk.data, ARCHETYPE_CHUNK_SIZE });
+		chunks_.pop_back();
+	}
+	return moved;
+}
+
+void Archetype::Clear()
+{
+	for (auto& chunk : chunks_) {
+		for (size_t i = 0; i < types_.size(); i++) {
+			for (uint32_t row = 0; row < chunk.count; row++) {
+				types_[i]->destroy(GetComponent(chunk, static_cast<int>(i), row));
+			}
+		}
+		allocator_.Deallocate({ chunk.data, ARCHETYPE_CHUNK_SIZE });
+	}
+	chunks_.clear();
+}
+
+ArchetypeStorage::~ArchetypeStorage()
+{
+	for (auto archetype : archetypes_) {
+		delete archetype;
+	}
+}
+
+void ArchetypeStorage::Clear()
+{
+	//Keep the archetypes (and the transitions between them) around, they'll likely be needed again.
+	for (auto archetype : archetypes_) {
+		archetype->Clear();
+	}
+	records_.clear();
+	num_entities_ = 0;
+}
+
+ArchetypeStorage::EntityRecord* ArchetypeStorage::FindRecord(EntityID id)
+{
+	uint32_t index = GetEntityIndex(id);
+	if (index >= records_.size() || !records_[index].archetype || records_[index].id != id) {
+		return nullptr;
+	}
+	return &records_[index];
+}
+
+void ArchetypeStorage::AddRecord(EntityID id, Archetype* archetype, uint32_t chunk, uint32_t row)
+{
+	uint32_t index = GetEntityIndex(id);
+	if (index >= records_.size()) {
+		records_.resize(index + 1, { INVALID_ENTITY, nullptr, 0, 0 });
+	}
+	records_[index] = { id, archetype, chunk, row };
+	num_entities_++;
+}
+
+void ArchetypeStorage::RemoveRecord(EntityID id)
+{
+	auto record = FindRecord(id);
+	Expects(record != nullptr);
+	record->archetype = nullptr;
+	num_entities_--;
+}
+
+bool ArchetypeStorage::Contains(EntityID id)
+{
+	return FindRecord(id) != nullptr;
+}
+
+Archetype* ArchetypeStorage::GetArchetype(const ComponentTypeInfo* const* types, size_t count, uint32_t hash)
+{
+	for (auto i = archetype_index_.First(hash); i != HashIndex::INVALID_INDEX; i = archetype_index_.Next(i)) {
+		const auto& existing = archetypes_[i]->GetTypes();
+		if (existing.size() == count && std::equal(existing.begin(), existing.end(), types)) {
+			return archetypes_[i];
+		}
+	}
+	archetype_index_.Add(hash, static_cast<uint32_t>(archetypes_.size()));
+	archetypes_.push_back(new Archetype({ types, types + count }));
+	return archetypes_.back();
+}
+
+Archetype* ArchetypeStorage::GetArchetypeWith(Archetype* from, const ComponentTypeInfo* type)
+{
+	for (auto& edge : from->add_edges) {
+		if (edge.first == type->id) {
+			return edge.second;
+		}
+	}
+	auto types = from->GetTypes();
+	types.push_back(type);
+	SortComponentTypes(types.data(), types.size());
+	auto to = GetArchetype(types.data(), types.size(), HashComponentTypes(types.data(), types.size()));
+	from->add_edges.emplace_back(type->id, to);
+	return to;
+}
+
+Archetype* ArchetypeStorage::GetArchetypeWithout(Archetype* from, ComponentTypeID type)
+{
+	for (auto& edge : from->remove_edges) {
+		if (edge.first == type) {
+			return edge.second;
+		}
+	}
+	auto types = from->GetTypes();
+	types.erase(std::remove_if(types.begin(), types.end(), [type](const ComponentTypeInfo* t) { return t->id == type; }), types.end());
+	auto to = GetArchetype(types.data(), types.size(), HashComponentTypes(types.data(), types.size()));
+	from->remove_edges.emplace_back(type, to);
+	return to;
+}
+
+void ArchetypeStorage::CreateWithTypes(EntityID id, const ComponentTypeInfo* const* types, size_t count, uint32_t hash)
+{
+	Expects(GetEntityIndex(id) >= records_.size() || !records_[GetEntityIndex(id)].archetype);
+	auto archetype = GetArchetype(types, count, hash);
+	uint32_t chunk, row;
+	archetype->PushBack(id, &chunk, &row);
+	const auto& archetype_types = archetype->GetTypes();
+	for (size_t i = 0; i < archetype_types.size(); i++) {
+		archetype_types[i]->construct(archetype->GetComponent(archetype->GetChunk(chunk), static_cast<int>(i), row));
+	}
+	AddRecord(id, archetype, chunk, row);
+}
+
+void ArchetypeStorage::MoveEntity(EntityRecord* record, Archetype* to)
+{
+	Archetype* from = record->archetype;
+	const EntityID id = record->id;
+	uint32_t to_chunk, to_row;
+	to->PushBack(id, &to_chunk, &to_row);
+
+	auto& src_chunk = from->GetChunk(record->chunk);
+	auto& dst_chunk = to->GetChunk(to_chunk);
+	const auto& from_types = from->GetTypes();
+	for (size_t i = 0; i < from_types.size(); i++) {
+		void* src = from->GetComponent(src_chunk, static_cast<int>(i), record->row);
+		int column = to->FindColumn(from_types[i]->id);
+		if (column >= 0) {
+			from_types[i]->move(to->GetComponent(dst_chunk, column, to_row), src);
+		}
+		else {
+			from_types[i]->destroy(src);
+		}
+	}
+
+	EntityID moved = from->RemoveAndFill(record->chunk, record->row);
+	if (moved != INVALID_ENTITY) {
+		auto moved_record = FindRecord(moved);
+		moved_record->chunk = record->chunk;
+		moved_record->row = record->row;
+	}
+
+	record->archetype = to;
+	record->chunk = to_chunk;
+	record->row = to_row;
+}
+
+void ArchetypeStorage::Destroy(EntityID id)
+{
+	auto record = FindRecord(id);
+	if (!record) {
+		return;
+	}
+	Archetype* archetype = record->archetype;
+	auto& chunk = archetype->GetChunk(record->chunk);
+	const auto& types = archetype->GetTypes();
+	for (size_t i = 0; i < types.size(); i++) {
+		types[i]->destroy(archetype->GetComponent(chunk, static_cast<int>(i), record->row));
+	}
+
+	EntityID moved = archetype->RemoveAndFill(record->chunk, record->row);
+	if (moved != INVALID_ENTITY) {
+		auto moved_record = FindRecord(moved);
+		moved_record->chunk = record->chunk;
+		moved_record->row = record->row;
+	}
+	RemoveRecord(id);
+}
+
+void* ArchetypeStorage::AddComponent(EntityID id, const ComponentTypeInfo* type)
+{
+	auto record = FindRecord(id);
+	if (!record) {
+		CreateWithTypes(id, &type, 1, HashComponentTypes(&type, 1));
+		record = FindRecord(id);
+	}
+	else {
+		Archetype* from = record->archetype;
+		int column = from->FindColumn(type->id);
+		if (column >= 0) {
+			return from->GetComponent(from->GetChunk(record->chunk), column, record->row);
+		}
+		MoveEntity(record, GetArchetypeWith(from, type));
+		Archetype* to = record->archetype;
+		type->construct(to->GetComponent(to->GetChunk(record->chunk), to->FindColumn(type->id), record->row));
+	}
+	Archetype* archetype = record->archetype;
+	return archetype->GetComponent(archetype->GetChunk(record->chunk), archetype->FindColumn(type->id), record->row);
+}
+
+void ArchetypeStorage::RemoveComponent(EntityID id, ComponentTypeID type)
+{
+	auto record = FindRecord(id);
+	if (!record || record->archetype->FindColumn(type) < 0) {
+		return;
+	}
+	MoveEntity(record, GetArchetypeWithout(record->archetype, type));
+}
+
+void* ArchetypeStorage::GetComponent(EntityID id, ComponentTypeID type)
+{
+	auto record = FindRecord(id);
+	if (!record) {
+		return nullptr;
+	}
+	Archetype* archetype = record->archetype;
+	int column = archetype->FindColumn(type);
+	if (column < 0) {
+		return nullptr;
+	}
+	return archetype->GetComponent(archetype->GetChunk(record->chunk), column, record->row);
+}
+
+}
+}
@@ -0,0 +1,261 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+#include "ECS/Entities.h"
+#include "Utilities/Allocators.h"
+#include "Utilities/HashIndex.h"
+
+namespace rkg
+{
+namespace ecs
+{
+
+/*
+	Archetype storage: entities with the same set of component types are stored together, in 16 KB chunks
+	with one array per component type (SoA). Iterating several components at once is then a linear walk
+	over a few arrays per chunk, with no per-entity lookups.
+	Adding or removing a component moves the entity (and all its components) to another archetype, so this
+	suits components which are iterated often and added/removed rarely. ComponentContainer is still the
+	better fit for components which come and go.
+	Components here don't need to derive from Component, since chunks store the entity ids separately.
+	This is a standalone container - Scene, View and ParallelForEach don't know about it, and it's iterated
+	with its own ForEach/ForEachChunk.
+*/
+
+//Type-erased operations for a component type, so chunks can manage components they only know by id.
+struct ComponentTypeInfo
+{
+	ComponentTypeID id;
+	uint32_t size;
+	uint32_t alignment;
+	void(*construct)(void* dst);
+	void(*destroy)(void* ptr);
+	void(*move)(void* dst, void* src); //Move constructs dst from src, then destroys src.
+};
+
+//Sorts types by id, the order archetypes keep them in.
+void SortComponentTypes(const ComponentTypeInfo** types, size_t count);
+//Hash of a sorted type list, used to find the archetype holding exactly those types.
+uint32_t HashComponentTypes(const ComponentTypeInfo* const* types, size_t count);
+
+template<typename T>
+const ComponentTypeInfo* GetComponentTypeInfo()
+{
+	static const ComponentTypeInfo info = {
+		GetComponentTypeID<T>(),
+		sizeof(T),
+		alignof(T),
+		[](void* dst) { new(dst) T(); },
+		[](void* ptr) { static_cast<T*>(ptr)->~T(); },
+		[](void* dst, void* src) {
+			new(dst) T(std::move(*static_cast<T*>(src)));
+			static_cast<T*>(src)->~T();
+		}
+	};
+	return &info;
+}
+
+static constexpr size_t ARCHETYPE_CHUNK_SIZE{ KILO(16) };
+//Each array in a chunk starts on this alignment, so they can be loaded with aligned SIMD loads.
+static constexpr size_t ARCHETYPE_ARRAY_ALIGNMENT{ 16 };
+//Chunks themselves start on a cache line, which also keeps the array offsets above aligned.
+static constexpr size_t ARCHETYPE_CHUNK_ALIGNMENT{ 64 };
+static_assert(ARCHETYPE_CHUNK_ALIGNMENT % ARCHETYPE_ARRAY_ALIGNMENT == 0, "Chunk alignment must keep the arrays aligned.");
+
+struct ArchetypeChunk
+{
+	char* data; //Entity ids, followed by one array per component type.
+	uint32_t count;
+};
+
+class Archetype
+{
+public:
+	//types must be sorted by id, with no duplicates.
+	explicit Archetype(std::vector<const ComponentTypeInfo*> types);
+	~Archetype();
+	Archetype(const Archetype&) = delete;
+	Archetype& operator=(const Archetype&) = delete;
+
+	inline const std::vector<const ComponentTypeInfo*>& GetTypes() const { return types_; }
+	inline uint32_t GetChunkCapacity() const { return chunk_capacity_; }
+	inline size_t GetNumChunks() const { return chunks_.size(); }
+	inline ArchetypeChunk& GetChunk(size_t i) { return chunks_[i]; }
+	size_t GetNumEntities() const;
+
+	//Index of the array holding type id, or -1 if entities in this archetype don't have it.
+	int FindColumn(ComponentTypeID id) const;
+	bool HasAll(const ComponentTypeID* ids, int count) const;
+
+	inline EntityID* GetEntities(const ArchetypeChunk& chunk) const
+	{
+		return reinterpret_cast<EntityID*>(chunk.data);
+	}
+
+	inline void* GetColumn(const ArchetypeChunk& chunk, int column) const
+	{
+		return chunk.data + column_offsets_[column];
+	}
+
+	inline void* GetComponent(const ArchetypeChunk& chunk, int column, uint32_t row) const
+	{
+		return chunk.data + column_offsets_[column] + row * types_[column]->size;
+	}
+
+	//Adds an entity at the end, with its components left unconstructed.
+	void PushBack(EntityID id, uint32_t* chunk_index, uint32_t* row);
+	//Removes an entity whose components have already been destroyed or moved out, filling the gap with the last entity.
+	//Returns the id of the entity which was moved, or INVALID_ENTITY if nothing had to move.
+	EntityID RemoveAndFill(uint32_t chunk_index, uint32_t row);
+	//Destroys all components, and frees the chunks.
+	void Clear();
+
+	//Cached transitions to the archetype with one type added/removed, so adding and removing components doesn't search.
+	std::vector<std::pair<ComponentTypeID, Archetype*>> add_edges;
+	std::vector<std::pair<ComponentTypeID, Archetype*>> remove_edges;
+
+private:
+	std::vector<const ComponentTypeInfo*> types_;
+	std::vector<uint32_t> column_offsets_;
+	uint32_t chunk_capacity_;
+	std::vector<ArchetypeChunk> chunks_;
+	AlignedMallocator<ARCHETYPE_CHUNK_ALIGNMENT> allocator_;
+};
+
+class ArchetypeStorage
+{
+public:
+	ArchetypeStorage() = default;
+	~ArchetypeStorage();
+	ArchetypeStorage(const ArchetypeStorage&) = delete;
+	ArchetypeStorage& operator=(const ArchetypeStorage&) = delete;
+
+	//Adds an entity, with a default constructed component of each type given.
+	template<typename... Ts>
+	void Create(EntityID id);
+	void Destroy(EntityID id);
+	bool Contains(EntityID id);
+
+	//Adding or removing components moves the entity to another archetype, invalidating pointers to its components.
+	template<typename T>
+	T* Add(EntityID id);
+	template<typename T>
+	void Remove(EntityID id);
+	template<typename T>
+	T* Get(EntityID id);
+
+	//Calls fn(EntityID, Ts&...) for each entity which has all of Ts.
+	template<typename... Ts, typename Fn>
+	void ForEach(Fn&& fn);
+	//Calls fn(uint32_t count, const EntityID* entities, Ts*... arrays) for each chunk of entities which have all of Ts.
+	template<typename... Ts, typename Fn>
+	void ForEachChunk(Fn&& fn);
+
+	void Clear();
+	inline size_t GetNumEntities() const { return num_entities_; }
+	inline size_t GetNumArchetypes() const { return archetypes_.size(); }
+
+private:
+	struct EntityRecord
+	{
+		EntityID id;
+		Archetype* archetype; //nullptr if this entity index isn't stored here.
+		uint32_t chunk;
+		uint32_t row;
+	};
+
+	std::vector<EntityRecord> records_; //Indexed by entity index.
+	size_t num_entities_{ 0 };
+	std::vector<Archetype*> archetypes_;
+	HashIndex archetype_index_; //Type list hash to position in archetypes_.
+
+	EntityRecord* FindRecord(EntityID id);
+	void AddRecord(EntityID id, Archetype* archetype, uint32_t chunk, uint32_t row);
+	void RemoveRecord(EntityID id);
+
+	//types must be sorted, and hash be their HashComponentTypes.
+	void CreateWithTypes(EntityID id, const ComponentTypeInfo* const* types, size_t count, uint32_t hash);
+	Archetype* GetArchetype(const ComponentTypeInfo* const* types, size_t count, uint32_t hash);
+	Archetype* GetArchetypeWith(Archetype* from, const ComponentTypeInfo* type);
+	Archetype* GetArchetypeWithout(Archetype* from, ComponentTypeID type);
+	//Moves the entity and the components both archetypes have, and destroys the rest. Components only in 'to' are left unconstructed.
+	void MoveEntity(EntityRecord* record, Archetype* to);
+	void* AddComponent(EntityID id, const ComponentTypeInfo* type);
+	void RemoveComponent(EntityID id, ComponentTypeID type);
+	void* GetComponent(EntityID id, ComponentTypeID type);
+
+	template<typename... Ts, typename Fn, size_t... Is>
+	static void CallForChunk(Fn& fn, Archetype* archetype, ArchetypeChunk& chunk, const int* columns, std::index_sequence<Is...>)
+	{
+		fn(chunk.count, archetype->GetEntities(chunk), static_cast<Ts*>(archetype->GetColumn(chunk, columns[Is]))...);
+	}
+};
+
+template<typename... Ts>
+void ArchetypeStorage::Create(EntityID id)
+{
+	//Same types every call, so only sort and hash them once.
+	struct Signature
+	{
+		std::array<const ComponentTypeInfo*, sizeof...(Ts)> types;
+		uint32_t hash;
+	};
+	static const Signature signature = [] {
+		Signature s{ { { GetComponentTypeInfo<Ts>()... } }, 0 };
+		SortComponentTypes(s.types.data(), s.types.size());
+		s.hash = HashComponentTypes(s.types.data(), s.types.size());
+		return s;
+	}();
+	CreateWithTypes(id, signature.types.data(), signature.types.size(), signature.hash);
+}
+
+template<typename T>
+T* ArchetypeStorage::Add(EntityID id)
+{
+	return static_cast<T*>(AddComponent(id, GetComponentTypeInfo<T>()));
+}
+
+template<typename T>
+void ArchetypeStorage::Remove(EntityID id)
+{
+	RemoveComponent(id, GetComponentTypeID<T>());
+}
+
+template<typename T>
+T* ArchetypeStorage::Get(EntityID id)
+{
+	return static_cast<T*>(GetComponent(id, GetComponentTypeID<T>()));
+}
+
+template<typename... Ts, typename Fn>
+void ArchetypeStorage::ForEachChunk(Fn&& fn)
+{
+	static_assert(sizeof...(Ts) > 0, "Need at least one component type to iterate over.");
+	const ComponentTypeID ids[] = { GetComponentTypeID<Ts>()... };
+	for (auto archetype : archetypes_) {
+		if (!archetype->HasAll(ids, sizeof...(Ts))) {
+			continue;
+		}
+		const int columns[] = { archetype->FindColumn(GetComponentTypeID<Ts>())... };
+		for (size_t i = 0; i < archetype->GetNumChunks(); i++) {
+			CallForChunk<Ts...>(fn, archetype, archetype->GetChunk(i), columns, std::index_sequence_for<Ts...>{});
+		}
+	}
+}
+
+template<typename... Ts, typename Fn>
+void ArchetypeStorage::ForEach(Fn&& fn)
+{
+	ForEachChunk<Ts...>([&fn](uint32_t count, const EntityID* entities, Ts*... arrays) {
+		for (uint32_t i = 0; i < count; i++) {
+			fn(entities[i], arrays[i]...);
+		}
+	});
+}
+
+} //end namespace ecs;
+} //end namespace rkg;
@@ -0,0 +1,185 @@
+#include "CommandBuffer.h"
+
+#include <algorithm>
+#include <tuple>
+#include <cstddef>
+
+namespace rkg
+{
+namespace ecs
+{
+
+EntityCommandBuffer::EntityCommandBuffer(Scene* scene)
+	: scene_{ scene }, buffers_(std::max(GetNumJobThreads(), 1)), global_sequence_{ UsingFibers() }
+{
+}
+
+EntityCommandBuffer::~EntityCommandBuffer()
+{
+	Clear();
+	for (auto& buffer : buffers_) {
+		for (auto& block : buffer.blocks) {
+			allocator_.Deallocate(block);
+		}
+	}
+}
+
+EntityCommandBuffer::ThreadBuffer& EntityCommandBuffer::GetThreadBuffer()
+{
+	int thread = GetThreadIndex();
+	Expects(thread != EXTERNAL_THREAD_INDEX && thread < static_cast<int>(buffers_.size()) && "Only job threads can record commands.");
+	return buffers_[thread];
+}
+
+void* EntityCommandBuffer::AllocatePayload(ThreadBuffer& buffer, size_t size, size_t alignment)
+{
+	Expects(alignment <= alignof(std::max_align_t));
+	if (size > PAYLOAD_BLOCK_SIZE) {
+		auto block = allocator_.Allocate(size);
+		ASSERT(block.ptr != nullptr && "Failed to allocate command payload!");
+		buffer.large_blocks.push_back(block);
+		return block.ptr;
+	}
+
+	size_t offset = RoundToAligned(buffer.block_used, alignment);
+	if (buffer.blocks.empty() || offset + size > PAYLOAD_BLOCK_SIZE) {
+		if (!buffer.blocks.empty()) {
+			buffer.current_block++;
+		}
+		if (buffer.current_block == buffer.blocks.size()) {
+			auto block = allocator_.Allocate(PAYLOAD_BLOCK_SIZE);
+			ASSERT(block.ptr != nullptr && "Failed to allocate command payload!");
+			buffer.blocks.push_back(block);
+		}
+		offset = 0;
+	}
+	buffer.block_used = offset + size;
+	return static_cast<char*>(buffer.blocks[buffer.current_block].ptr) + offset;
+}
+
+void EntityCommandBuffer::ResetPayloads(ThreadBuffer& buffer)
+{
+	for (auto& block : buffer.large_blocks) {
+		allocator_.Deallocate(block);
+	}
+	buffer.large_blocks.clear();
+	buffer.current_block = 0;
+	buffer.block_used = 0;
+}
+
+void EntityCommandBuffer::Record(CommandType type, bool pending, EntityID entity, void* container, ApplyFn apply, DestroyFn destroy, void* payload)
+{
+	auto& buffer = GetThreadBuffer();
+	Command command;
+	command.type = type;
+	command.pending = pending;
+	if (global_sequence_) {
+		command.thread = 0;
+		command.sequence = next_sequence_.fetch_add(1, std::memory_order_relaxed);
+	}
+	else {
+		command.thread = static_cast<uint32_t>(&buffer - buffers_.data());
+		command.sequence = static_cast<uint32_t>(buffer.commands.size());
+	}
+	command.entity = entity;
+	command.container = container;
+	command.apply = apply;
+	command.destroy = destroy;
+	command.payload = payload;
+	buffer.commands.push_back(command);
+}
+
+PendingEntity EntityCommandBuffer::CreateEntity()
+{
+	return{ num_pending_.fetch_add(1, std::memory_order_relaxed) };
+}
+
+void EntityCommandBuffer::DestroyEntity(EntityID id)
+{
+	Record(CommandType::DESTROY_ENTITY, false, id, nullptr, nullptr, nullptr, nullptr);
+}
+
+size_t EntityCommandBuffer::GetNumCommands() const
+{
+	size_t count = 0;
+	for (auto& buffer : buffers_) {
+		count += buffer.commands.size();
+	}
+	return count;
+}
+
+void EntityCommandBuffer::Playback(std::vector<EntityID>* created)
+{
+	//Create the new entities first, so everything else can refer to them.
+	const uint32_t num_pending = num_pending_.exchange(0, std::memory_order_relaxed);
+	std::vector<EntityID> new_ids(num_pending);
+	for (uint32_t i = 0; i < num_pending; i++) {
+		new_ids[i] = scene_->CreateEntity()->id;
+	}
+
+	std::vector<Command*> changes;
+	std::vector<EntityID> destroyed;
+	for (auto& buffer : buffers_) {
+		for (auto& command : buffer.commands) {
+			if (command.pending) {
+				command.entity = new_ids[command.entity];
+				command.pending = false;
+			}
+			if (command.type == CommandType::DESTROY_ENTITY) {
+				destroyed.push_back(command.entity);
+			}
+			else {
+				changes.push_back(&command);
+			}
+		}
+	}
+
+	//Apply component changes one container at a time, in entity order. 
+	//Changes to the same entity stay in the order they were recorded.
+	std::sort(changes.begin(), changes.end(), [](const Command* a, const Command* b) {
+		return std::make_tuple(reinterpret_cast<uintptr_t>(a->container), GetEntityIndex(a->entity), a->thread, a->sequence) <
+			std::make_tuple(reinterpret_cast<uintptr_t>(b->container), GetEntityIndex(b->entity), b->thread, b->sequence);
+	});
+	for (auto command : changes) {
+		if (scene_->IsAlive(command->entity)) {
+			command->apply(command->container, command->entity, command->payload);
+		}
+		else if (command->destroy) {
+			command->destroy(command->payload);
+		}
+	}
+
+	std::sort(destroyed.begin(), destroyed.end());
+	destroyed.erase(std::unique(destroyed.begin(), destroyed.end()), destroyed.end());
+	for (auto id : destroyed) {
+		scene_->DestroyEntity(id);
+	}
+
+	for (auto& buffer : buffers_) {
+		buffer.commands.clear();
+		ResetPayloads(buffer);
+	}
+	next_sequence_.store(0, std::memory_order_relaxed);
+
+	if (created) {
+		*created = std::move(new_ids);
+	}
+}
+
+void EntityCommandBuffer::Clear()
+{
+	for (auto& buffer : buffers_) {
+		for (auto& command : buffer.commands) {
+			if (command.destroy) {
+				command.destroy(command.payload);
+			}
+		}
+		buffer.commands.clear();
+		ResetPayloads(buffer);
+	}
+	num_pending_.store(0, std::memory_order_relaxed);
+	next_sequence_.store(0, std::memory_order_relaxed);
+}
+
+}
+}
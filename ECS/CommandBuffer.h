@@ -0,0 +1,166 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <new>
+#include <utility>
+
+#include "ECS/Entities.h"
+#include "ECS/JobSystem.h"
+#include "Utilities/Allocators.h"
+
+namespace rkg
+{
+namespace ecs
+{
+
+/*
+	Records structural changes (creating/destroying entities, adding/removing components) from jobs,
+	and applies them later, all at once, at a point where nothing is iterating over the scene.
+	Each job thread records into its own buffer, so recording takes no locks. Playback applies the
+	changes in batches: entity creation first, then component changes sorted by container and entity,
+	then entity destruction. Changes to the same component of the same entity are applied in the order
+	they were recorded.
+
+	Entities created through the buffer don't have an id until playback, so CreateEntity returns a
+	PendingEntity which can be used to add components to it (from any thread) in the same buffer.
+	Destroying an entity only removes it from the scene - remove its components as well if they
+	should go with it.
+
+	Make the buffer after InitializeWorkerThreads - it needs to know how many threads there are.
+*/
+
+struct PendingEntity
+{
+	uint32_t index;
+};
+
+class EntityCommandBuffer
+{
+public:
+	explicit EntityCommandBuffer(Scene* scene);
+	~EntityCommandBuffer();
+	EntityCommandBuffer(const EntityCommandBuffer&) = delete;
+	EntityCommandBuffer& operator=(const EntityCommandBuffer&) = delete;
+
+	//Recording - safe to call from any job, concurrently.
+	PendingEntity CreateEntity();
+	void DestroyEntity(EntityID id);
+
+	//Adds a component (or replaces the existing one) with the given value. Works with any ComponentContainer.
+	template<typename Container>
+	void AddComponent(Container& container, EntityID id, typename Container::ValueType value);
+	template<typename Container>
+	void AddComponent(Container& container, PendingEntity entity, typename Container::ValueType value);
+	template<typename Container>
+	void RemoveComponent(Container& container, EntityID id);
+
+	//Applies everything recorded, and clears the buffer. Call from one thread, while no jobs are recording.
+	//If created isn't null, it's filled with the ids of the new entities - PendingEntity e became (*created)[e.index].
+	void Playback(std::vector<EntityID>* created = nullptr);
+
+	//Throws away everything recorded.
+	void Clear();
+
+	size_t GetNumCommands() const;
+
+private:
+	enum class CommandType : uint8_t
+	{
+		ADD_COMPONENT,
+		REMOVE_COMPONENT,
+		DESTROY_ENTITY,
+	};
+
+	using ApplyFn = void(*)(void* container, EntityID id, void* payload);
+	using DestroyFn = void(*)(void* payload);
+
+	struct Command
+	{
+		CommandType type;
+		bool pending; //entity is a PendingEntity index, rather than an id.
+		uint32_t thread;
+		uint32_t sequence; //Within the thread's buffer, or across all threads in fiber mode.
+		EntityID entity;
+		void* container;
+		ApplyFn apply;
+		DestroyFn destroy;
+		void* payload;
+	};
+
+	//Component values are kept in fixed size blocks, so they never move once recorded.
+	static constexpr size_t PAYLOAD_BLOCK_SIZE{ KILO(16) };
+
+	struct ThreadBuffer
+	{
+		std::vector<Command> commands;
+		std::vector<MemoryBlock> blocks; //Kept between playbacks.
+		size_t current_block{ 0 };
+		size_t block_used{ 0 };
+		std::vector<MemoryBlock> large_blocks; //Values too big for a block, freed on playback.
+		char padding[64]; //Keeps each thread's buffer off the others' cache lines.
+	};
+
+	Scene* scene_;
+	std::vector<ThreadBuffer> buffers_;
+	std::atomic<uint32_t> num_pending_{ 0 };
+	std::atomic<uint32_t> next_sequence_{ 0 };
+	bool global_sequence_; //With fibers, a job can move threads part way through, so its commands are ordered across all threads.
+	Mallocator allocator_;
+
+	ThreadBuffer& GetThreadBuffer();
+	void* AllocatePayload(ThreadBuffer& buffer, size_t size, size_t alignment);
+	void ResetPayloads(ThreadBuffer& buffer);
+	void Record(CommandType type, bool pending, EntityID entity, void* container, ApplyFn apply, DestroyFn destroy, void* payload);
+
+	template<typename Container>
+	void RecordAdd(Container& container, bool pending, EntityID entity, typename Container::ValueType&& value);
+};
+
+template<typename Container>
+void EntityCommandBuffer::RecordAdd(Container& container, bool pending, EntityID entity, typename Container::ValueType&& value)
+{
+	using T = typename Container::ValueType;
+	auto& buffer = GetThreadBuffer();
+	void* payload = AllocatePayload(buffer, sizeof(T), alignof(T));
+	new(payload) T(std::move(value));
+
+	ApplyFn apply = [](void* c, EntityID id, void* p) {
+		auto container = static_cast<Container*>(c);
+		auto value = static_cast<T*>(p);
+		T* component = container->Write(id);
+		if (!component) {
+			component = container->Create(id);
+		}
+		*component = std::move(*value);
+		component->entity_id = id;
+		value->~T();
+	};
+	DestroyFn destroy = [](void* p) {
+		static_cast<T*>(p)->~T();
+	};
+	Record(CommandType::ADD_COMPONENT, pending, entity, &container, apply, destroy, payload);
+}
+
+template<typename Container>
+void EntityCommandBuffer::AddComponent(Container& container, EntityID id, typename Container::ValueType value)
+{
+	RecordAdd(container, false, id, std::move(value));
+}
+
+template<typename Container>
+void EntityCommandBuffer::AddComponent(Container& container, PendingEntity entity, typename Container::ValueType value)
+{
+	RecordAdd(container, true, entity.index, std::move(value));
+}
+
+template<typename Container>
+void EntityCommandBuffer::RemoveComponent(Container& container, EntityID id)
+{
+	ApplyFn apply = [](void* c, EntityID id, void*) {
+		static_cast<Container*>(c)->Remove(id);
+	};
+	Record(CommandType::REMOVE_COMPONENT, false, id, &container, apply, nullptr, nullptr);
+}
+
+} //end namespace ecs;
+} //end namespace rkg;
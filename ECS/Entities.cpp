@@ -1,11 +1,33 @@
 #include "Entities.h"
 
-
+#include <atomic>
 
 
 namespace rkg
 {
 namespace ecs
 {
+
+ComponentTypeID NextComponentTypeID()
+{
+	static std::atomic<ComponentTypeID> next_id{ 0 };
+	return next_id++;
+}
+
+namespace {
+	//Starts at 1, so a system which has never run (and passes 0) sees everything.
+	std::atomic<uint32_t> change_version{ 1 };
+}
+
+uint32_t GetChangeVersion()
+{
+	return change_version.load(std::memory_order_relaxed);
+}
+
+void AdvanceChangeVersion()
+{
+	change_version.fetch_add(1, std::memory_order_relaxed);
+}
+
 }
 }
\ No newline at end of file
@@ -1,8 +1,12 @@
 #pragma once
 #include <vector>
+#include <type_traits>
+#include <algorithm>
+#include <atomic>
 
 #include "Utilities/Utilities.h"
 #include "Utilities/HashIndex.h"
+#include "Utilities/PagedArray.h"
 #include "Utilities/Geometry.h"
 
 namespace rkg
@@ -10,7 +14,26 @@ namespace rkg
 namespace ecs
 {
 
+/*
+	Entity ids are an index and a generation. Indices are reused once an entity is destroyed, so they stay 
+	dense enough to index flat arrays with, and the generation is bumped on every reuse so stale ids don't 
+	find the new entity (until the generation wraps around).
+*/
 using EntityID = uint32_t;
+static constexpr EntityID INVALID_ENTITY{ UINT32_MAX };
+
+static constexpr uint32_t ENTITY_INDEX_BITS{ 24 };
+static constexpr uint32_t ENTITY_INDEX_MASK{ (1u << ENTITY_INDEX_BITS) - 1 };
+static constexpr uint32_t ENTITY_GENERATION_MASK{ (1u << (32 - ENTITY_INDEX_BITS)) - 1 };
+//The top index is never handed out, so INVALID_ENTITY can't be a real id.
+static constexpr uint32_t MAX_ENTITIES{ ENTITY_INDEX_MASK };
+
+inline uint32_t GetEntityIndex(EntityID id) { return id & ENTITY_INDEX_MASK; }
+inline uint32_t GetEntityGeneration(EntityID id) { return id >> ENTITY_INDEX_BITS; }
+inline EntityID MakeEntityID(uint32_t index, uint32_t generation)
+{
+	return (generation & ENTITY_GENERATION_MASK) << ENTITY_INDEX_BITS | (index & ENTITY_INDEX_MASK);
+}
 
 struct Entity
 {
@@ -26,135 +49,499 @@ struct Component
 	EntityID entity_id;
 };
 
+//Small, dense ids for component types, for anything that needs to index by type (e.g. system access declarations).
+//Ids are handed out the first time each type is asked for, so they can differ between runs.
+using ComponentTypeID = uint32_t;
+
+ComponentTypeID NextComponentTypeID();
+
+template<typename T>
+ComponentTypeID GetComponentTypeID()
+{
+	static const ComponentTypeID id = NextComponentTypeID();
+	return id;
+}
+
 class Scene
 {
 private:
-	HashIndex hash_index_;
+	static constexpr uint32_t NO_SLOT{ UINT32_MAX };
+
+	struct EntitySlot
+	{
+		uint32_t generation;
+		uint32_t dense_index; //Position in entities_, or NO_SLOT if the index is free.
+		uint32_t next_free;
+	};
+
+	std::vector<EntitySlot> slots_; //Indexed by entity index.
 	std::vector<Entity> entities_;
-	EntityID next_id_;
+	//Free indices are reused oldest first, so each slot's generation wraps as slowly as possible.
+	uint32_t free_head_{ NO_SLOT };
+	uint32_t free_tail_{ NO_SLOT };
+
+	inline uint32_t AllocateIndex()
+	{
+		if (free_head_ != NO_SLOT) {
+			uint32_t index = free_head_;
+			free_head_ = slots_[index].next_free;
+			if (free_head_ == NO_SLOT) {
+				free_tail_ = NO_SLOT;
+			}
+			return index;
+		}
+		Expects(slots_.size() < MAX_ENTITIES && "Too many entities!");
+		slots_.push_back({ 0, NO_SLOT, NO_SLOT });
+		return static_cast<uint32_t>(slots_.size() - 1);
+	}
+
+	inline void FreeIndex(uint32_t index)
+	{
+		auto& slot = slots_[index];
+		slot.generation = (slot.generation + 1) & ENTITY_GENERATION_MASK;
+		slot.dense_index = NO_SLOT;
+		slot.next_free = NO_SLOT;
+		if (free_tail_ != NO_SLOT) {
+			slots_[free_tail_].next_free = index;
+		}
+		else {
+			free_head_ = index;
+		}
+		free_tail_ = index;
+	}
+
+	inline uint32_t FindDenseIndex(EntityID id) const
+	{
+		uint32_t index = GetEntityIndex(id);
+		if (index >= slots_.size() || slots_[index].generation != GetEntityGeneration(id)) {
+			return NO_SLOT;
+		}
+		return slots_[index].dense_index;
+	}
 public:
 	inline Entity* CreateEntity()
 	{
-		EntityID id = next_id_++;
+		uint32_t index = AllocateIndex();
+		auto& slot = slots_[index];
+		slot.dense_index = static_cast<uint32_t>(entities_.size());
 		entities_.emplace_back();
-		hash_index_.Add(id, entities_.size() - 1);
-		entities_.back().id = id;
+		entities_.back().id = MakeEntityID(index, slot.generation);
 		return &entities_.back();
 	}
 
-	inline Entity* GetEntity(EntityID id)
+	//Makes count entities at once, writing their ids to ids. Recycled indices come off the free list as usual,
+	//and the rest are added to the index table in one go.
+	inline void CreateEntities(size_t count, EntityID* ids)
 	{
-		uint32_t num_entities = entities_.size();
-		for (auto i = hash_index_.First(id);
-			i != HashIndex::INVALID_INDEX && i < num_entities;
-			i = hash_index_.Next(i)) {
-			if (entities_[i].id == id) {
-				return &entities_[i];
-			}
+		const size_t first = entities_.size();
+		entities_.resize(first + count);
+		//ids hold bare indices until the generations are filled in at the end.
+		size_t i = 0;
+		for (; i < count && free_head_ != NO_SLOT; i++) {
+			ids[i] = AllocateIndex();
+		}
+		Expects(slots_.size() + (count - i) <= MAX_ENTITIES && "Too many entities!");
+		uint32_t index = static_cast<uint32_t>(slots_.size());
+		slots_.resize(slots_.size() + (count - i), { 0, NO_SLOT, NO_SLOT });
+		for (; i < count; i++) {
+			ids[i] = index++;
 		}
-		return nullptr;
+
+		for (i = 0; i < count; i++) {
+			auto& slot = slots_[GetEntityIndex(ids[i])];
+			slot.dense_index = static_cast<uint32_t>(first + i);
+			ids[i] = MakeEntityID(GetEntityIndex(ids[i]), slot.generation);
+			entities_[first + i].id = ids[i];
+		}
+	}
+
+	inline Entity* GetEntity(EntityID id)
+	{
+		uint32_t i = FindDenseIndex(id);
+		return i != NO_SLOT ? &entities_[i] : nullptr;
+	}
+
+	inline bool IsAlive(EntityID id) const
+	{
+		return FindDenseIndex(id) != NO_SLOT;
 	}
 
 	inline void DestroyEntity(EntityID id)
 	{
-		uint32_t num_components = entities_.size();
-		for (auto i = hash_index_.First(id);
-			i != HashIndex::INVALID_INDEX && i < num_components;
-			i = hash_index_.Next(i)) {
-			if (entities_[i].id == id) {
-				//Remove this entry by swapping it with the last one in the data_ array.
-				entities_[i] = entities_.back();
-				//Need to update the appropriate slot in the hash_index.
-				//How to do this?
-				auto other_index = entities_.size() - 1;
-				auto other_id = entities_[i].id;
-				hash_index_.Remove(other_id, other_index);
-				hash_index_.Remove(id, i);
-				hash_index_.Add(other_id, i);
-				entities_.pop_back();
-
-				return;
-			}
+		uint32_t i = FindDenseIndex(id);
+		if (i == NO_SLOT) {
+			return;
+		}
+		//Remove this entry by swapping it with the last one in the entities_ array.
+		if (i != entities_.size() - 1) {
+			entities_[i] = entities_.back();
+			slots_[GetEntityIndex(entities_[i].id)].dense_index = i;
 		}
+		entities_.pop_back();
+		FreeIndex(GetEntityIndex(id));
 	}
 
+	//One past the largest entity index handed out so far, for sizing flat per-entity arrays.
+	inline uint32_t GetIndexCapacity() const { return static_cast<uint32_t>(slots_.size()); }
+	inline size_t GetNumEntities() const { return entities_.size(); }
+
 	//For using range-based for loops.
 	inline auto begin() { return entities_.begin(); }
 	inline auto end() { return entities_.end(); }
 
+	//For snapshots - the packed entities, and the generation of each index.
+	inline const Entity* Data() const { return entities_.data(); }
+	inline uint32_t GetGeneration(uint32_t index) const { return slots_[index].generation; }
+
+	//Replaces every entity with the ones given, keeping their ids.
+	//generations holds the current generation of each of num_indices indices, so ids from before stay invalid.
+	inline void Restore(const Entity* entities, size_t count, const uint32_t* generations, uint32_t num_indices)
+	{
+		slots_.resize(num_indices);
+		for (uint32_t i = 0; i < num_indices; i++) {
+			slots_[i] = { generations[i], NO_SLOT, NO_SLOT };
+		}
+		entities_.assign(entities, entities + count);
+		for (size_t i = 0; i < count; i++) {
+			uint32_t index = GetEntityIndex(entities_[i].id);
+			Expects(index < num_indices && slots_[index].generation == GetEntityGeneration(entities_[i].id));
+			slots_[index].dense_index = static_cast<uint32_t>(i);
+		}
+		free_head_ = free_tail_ = NO_SLOT;
+		for (uint32_t i = 0; i < num_indices; i++) {
+			if (slots_[i].dense_index != NO_SLOT) {
+				continue;
+			}
+			if (free_tail_ != NO_SLOT) {
+				slots_[free_tail_].next_free = i;
+			}
+			else {
+				free_head_ = i;
+			}
+			free_tail_ = i;
+		}
+	}
+
+	//Destroys every entity. Their ids stay invalid afterwards, as with DestroyEntity.
 	inline void Clear() {
-		hash_index_.Clear();
+		for (auto& entity : entities_) {
+			FreeIndex(GetEntityIndex(entity.id));
+		}
 		entities_.clear();
 	}
 };
 
-template<typename T>
+/*
+	Lookup policies for ComponentContainer, mapping entity ids to positions in its packed component array.
+	Find takes a function returning the entity id stored at a position, to check candidates against.
+*/
+
+//Chained hash lookup. Small, but lookups walk a chain which grows with the number of components.
+class HashedComponentIndex
+{
+private:
+	HashIndex hash_index_;
+public:
+	template<typename IdAt>
+	inline uint32_t Find(EntityID id, uint32_t count, IdAt&& id_at) const
+	{
+		for (auto i = hash_index_.First(id);
+			 i != HashIndex::INVALID_INDEX && i < count;
+			 i = hash_index_.Next(i)) {
+			if (id_at(i) == id) {
+				return i;
+			}
+		}
+		return HashIndex::INVALID_INDEX;
+	}
+
+	inline void Add(EntityID id, uint32_t index) { hash_index_.Add(id, index); }
+	inline void Remove(EntityID id, uint32_t index) { hash_index_.Remove(id, index); }
+	inline void Clear() { hash_index_.Clear(); }
+};
+
+/*
+	Sparse set lookup - a sparse array indexed by entity index, holding positions in the packed array.
+	Constant time, at the cost of memory proportional to the largest entity index rather than the number of components.
+	The sparse array is split into pages which are only allocated once an id in their range is used.
+*/
+class SparseComponentIndex
+{
+private:
+	static constexpr uint32_t PAGE_SHIFT{ 12 };
+	static constexpr uint32_t PAGE_ENTRIES{ 1u << PAGE_SHIFT };
+	static constexpr uint32_t PAGE_MASK{ PAGE_ENTRIES - 1 };
+
+	std::vector<uint32_t*> pages_;
+	Mallocator allocator_;
+
+	inline uint32_t& Slot(EntityID id)
+	{
+		uint32_t index = GetEntityIndex(id);
+		uint32_t page = index >> PAGE_SHIFT;
+		if (page >= pages_.size()) {
+			pages_.resize(page + 1, nullptr);
+		}
+		if (!pages_[page]) {
+			auto block = allocator_.Allocate(PAGE_ENTRIES * sizeof(uint32_t));
+			ASSERT(block.ptr != nullptr && "Failed to allocate sparse index page!");
+			pages_[page] = static_cast<uint32_t*>(block.ptr);
+			memset(pages_[page], 0xff, PAGE_ENTRIES * sizeof(uint32_t));
+		}
+		return pages_[page][index & PAGE_MASK];
+	}
+public:
+	SparseComponentIndex() = default;
+	SparseComponentIndex(const SparseComponentIndex&) = delete;
+	SparseComponentIndex& operator=(const SparseComponentIndex&) = delete;
+
+	inline ~SparseComponentIndex()
+	{
+		for (auto page : pages_) {
+			if (page) {
+				allocator_.Deallocate({ page, PAGE_ENTRIES * sizeof(uint32_t) });
+			}
+		}
+	}
+
+	template<typename IdAt>
+	inline uint32_t Find(EntityID id, uint32_t count, IdAt&& id_at) const
+	{
+		uint32_t index = GetEntityIndex(id);
+		uint32_t page = index >> PAGE_SHIFT;
+		if (page >= pages_.size() || !pages_[page]) {
+			return HashIndex::INVALID_INDEX;
+		}
+		//The slot is shared by every generation of this index, so check the whole id.
+		uint32_t i = pages_[page][index & PAGE_MASK];
+		if (i < count && id_at(i) == id) {
+			return i;
+		}
+		return HashIndex::INVALID_INDEX;
+	}
+
+	inline void Add(EntityID id, uint32_t index) { Slot(id) = index; }
+	inline void Remove(EntityID id, uint32_t index)
+	{
+		auto& slot = Slot(id);
+		if (slot == index) {
+			slot = HashIndex::INVALID_INDEX;
+		}
+	}
+
+	inline void Clear()
+	{
+		for (auto page : pages_) {
+			if (page) {
+				memset(page, 0xff, PAGE_ENTRIES * sizeof(uint32_t));
+			}
+		}
+	}
+};
+
+/*
+	Change versions: a global counter, advanced once a frame by ecs::Run, which containers stamp components with 
+	when they're created or written through Write/MarkChanged. Systems which only care about what changed keep the 
+	version from the start of their last pass, and iterate with ForEachChangedSince. Anything written during that 
+	pass after they looked at it shows up again next time, rather than being missed.
+*/
+uint32_t GetChangeVersion();
+void AdvanceChangeVersion();
+
+/*
+	Components are kept packed in one array (removal swaps with the last one), with Index mapping entity ids into it.
+	The array is paged, so creating components never moves existing ones: a pointer from Create/Get stays valid
+	until that component is removed, or a removal moves it (the last one) into the gap. With structural changes
+	going through an EntityCommandBuffer, pointers are good for the rest of the frame.
+	Pages come from Allocator - a GrowingLinearAllocator keeps the whole container in one reserved address range.
+*/
+template<typename T, typename Index = HashedComponentIndex, typename Allocator = Mallocator>
 class ComponentContainer
 {
 private:
 	static_assert(std::is_base_of<Component, T>::value, "Invalid type for container.");
 
-	HashIndex hash_index_;
-	std::vector<T> data_;
+	//Versions are also tracked per block of components, so unchanged blocks can be skipped without looking at each one.
+	static constexpr uint32_t CHANGE_BLOCK_SHIFT{ 8 };
+
+	Index index_;
+	PagedArray<T, Allocator> data_;
+	PagedArray<uint32_t, Allocator> versions_;
+
+	//Jobs writing to different components of the same block (e.g. from View::ParallelForEach) all stamp it, so it's atomic.
+	//Copyable so it can live in a vector - the vector is only resized while nothing is writing.
+	struct BlockVersion
+	{
+		std::atomic<uint32_t> value;
+
+		BlockVersion(uint32_t version = 0) : value{ version } {}
+		BlockVersion(const BlockVersion& other) : value{ other.Load() } {}
+		BlockVersion& operator=(const BlockVersion& other)
+		{
+			value.store(other.Load(), std::memory_order_relaxed);
+			return *this;
+		}
+
+		inline uint32_t Load() const { return value.load(std::memory_order_relaxed); }
+	};
+	std::vector<BlockVersion> block_versions_;
+
+	inline void Stamp(size_t i, uint32_t version)
+	{
+		versions_[i] = version;
+		//Parallel writers in the same block all store the same version, so only store it if it's different.
+		auto& block_version = block_versions_[i >> CHANGE_BLOCK_SHIFT].value;
+		if (block_version.load(std::memory_order_relaxed) < version) {
+			block_version.store(version, std::memory_order_relaxed);
+		}
+	}
+
+	inline uint32_t Find(EntityID id) const
+	{
+		return index_.Find(id, static_cast<uint32_t>(data_.Size()), [this](uint32_t i) { return data_[i].entity_id; });
+	}
 public:
+	using ValueType = T;
+
 	inline T* Get(EntityID id)
 	{
-		uint32_t num_components = data_.size();
-		for (auto i = hash_index_.First(id); 
-			 i != HashIndex::INVALID_INDEX && i < num_components; 
-			 i = hash_index_.Next(i)) {
-			if (data_[i].entity_id == id) {
-				return &data_[i];
-			}
+		auto i = Find(id);
+		return i != HashIndex::INVALID_INDEX ? &data_[i] : nullptr;
+	}
+
+	//Get, and mark the component as changed.
+	inline T* Write(EntityID id)
+	{
+		auto i = Find(id);
+		if (i == HashIndex::INVALID_INDEX) {
+			return nullptr;
 		}
+		Stamp(i, GetChangeVersion());
+		return &data_[i];
+	}
 
-		return nullptr;
+	inline void MarkChanged(EntityID id)
+	{
+		auto i = Find(id);
+		if (i != HashIndex::INVALID_INDEX) {
+			Stamp(i, GetChangeVersion());
+		}
 	}
 
 	inline T* Create(EntityID id)
 	{
-		data_.emplace_back();
-		T* result = &data_.back();
+		T* result = &data_.Emplace();
 		result->entity_id = id;
-		hash_index_.Add(id, data_.size() - 1);
+		versions_.Emplace(0u);
+		const size_t i = data_.Size() - 1;
+		if (i >> CHANGE_BLOCK_SHIFT >= block_versions_.size()) {
+			block_versions_.push_back(0);
+		}
+		Stamp(i, GetChangeVersion());
+		index_.Add(id, static_cast<uint32_t>(i));
 		return result;
 	}
 
+	//Creates a component for each of count entities in one pass, all copies of prototype (with their entity_id set).
+	//They're consecutive in the packed array - returns the position of the first one, for setting anything which differs.
+	inline size_t CreateMany(const EntityID* ids, size_t count, const T& prototype)
+	{
+		const size_t first = data_.Size();
+		const uint32_t version = GetChangeVersion();
+		data_.Append(count, prototype);
+		versions_.Append(count, version);
+		const size_t num_blocks = (first + count + (1u << CHANGE_BLOCK_SHIFT) - 1) >> CHANGE_BLOCK_SHIFT;
+		block_versions_.resize(std::max(num_blocks, block_versions_.size()), 0);
+		for (size_t block = first >> CHANGE_BLOCK_SHIFT; block < num_blocks; block++) {
+			block_versions_[block].value.store(version, std::memory_order_relaxed);
+		}
+		for (size_t i = 0; i < count; i++) {
+			data_[first + i].entity_id = ids[i];
+			index_.Add(ids[i], static_cast<uint32_t>(first + i));
+		}
+		return first;
+	}
+
 	//NOTE: Could make the create function a templated function, 
 	//allowing us to pass arguments
 	//to construct our components.
 
 	inline void Remove(EntityID id)
 	{
-		uint32_t num_components = data_.size();
-		for (auto i = hash_index_.First(id);
-			 i != HashIndex::INVALID_INDEX && i < num_components;
-			 i = hash_index_.Next(i)) {
-			if (data_[i].entity_id == id) {
-				//Remove this entry by swapping it with the last one in the data_ array.
-				data_[i] = std::move(data_.back());
-				//Need to update the appropriate slot in the hash_index.
-				//How to do this?
-				auto other_index = data_.size() - 1;
-				auto other_id = data_[i].entity_id;
-				hash_index_.Remove(other_id, other_index);
-				hash_index_.Remove(id, i);
-				hash_index_.Add(other_id, i);
-				data_.pop_back();
-
-				return;
-			}
+		auto i = Find(id);
+		if (i == HashIndex::INVALID_INDEX) {
+			return;
+		}
+		//Remove this entry by swapping it with the last one in the data_ array, and point the index at its new position.
+		auto other_index = static_cast<uint32_t>(data_.Size() - 1);
+		index_.Remove(id, i);
+		if (i != other_index) {
+			auto other_id = data_[other_index].entity_id;
+			data_[i] = std::move(data_.Back());
+			Stamp(i, versions_[other_index]);
+			index_.Remove(other_id, other_index);
+			index_.Add(other_id, i);
+		}
+		data_.PopBack();
+		versions_.PopBack();
+		if (block_versions_.size() > ((data_.Size() + (1u << CHANGE_BLOCK_SHIFT) - 1) >> CHANGE_BLOCK_SHIFT)) {
+			block_versions_.pop_back();
 		}
-
 	}
 
 
 	inline void Clear()
 	{
-		hash_index_.Clear();
-		data_.clear();
+		index_.Clear();
+		data_.Clear();
+		versions_.Clear();
+		block_versions_.clear();
+	}
+
+	//Calls fn(T&) for each component created or changed at or after version.
+	template<typename Fn>
+	void ForEachChangedSince(uint32_t version, Fn&& fn)
+	{
+		const size_t count = data_.Size();
+		for (size_t block = 0; block < block_versions_.size(); block++) {
+			if (block_versions_[block].Load() < version) {
+				continue;
+			}
+			const size_t end = std::min(count, (block + 1) << CHANGE_BLOCK_SHIFT);
+			for (size_t i = block << CHANGE_BLOCK_SHIFT; i < end; i++) {
+				if (versions_[i] >= version) {
+					fn(data_[i]);
+				}
+			}
+		}
 	}
 
+	//Calls fn(const T* data, size_t count) for each contiguous run of the packed array, in order, for bulk copies (e.g. snapshots).
+	template<typename Fn>
+	void ForEachRange(Fn&& fn) const
+	{
+		data_.ForEachRange(fn);
+	}
+
+	//Replaces every component with count copied from data, rebuilding the index in one pass. All of them count as changed.
+	inline void Assign(const T* data, size_t count)
+	{
+		Clear();
+		data_.Assign(data, count);
+		for (size_t i = 0; i < count; i++) {
+			index_.Add(data_[i].entity_id, static_cast<uint32_t>(i));
+			versions_.Emplace(GetChangeVersion());
+		}
+		block_versions_.assign((count + (1u << CHANGE_BLOCK_SHIFT) - 1) >> CHANGE_BLOCK_SHIFT, GetChangeVersion());
+	}
+
+	inline uint32_t GetVersionAt(size_t i) const { return versions_[i]; }
+	inline void MarkChangedAt(size_t i) { Stamp(i, GetChangeVersion()); }
+
+	inline size_t Size() const { return data_.Size(); }
+	//Position in the packed array, for iterating by index (e.g. with ParallelFor).
+	inline T& At(size_t i) { return data_[i]; }
+
 	inline auto Begin()
 	{
 		return data_.begin();
@@ -171,5 +558,9 @@ private:
 
 };
 
+//Constant time Get/Create/Remove, for large numbers of components or lookup-heavy access.
+template<typename T>
+using SparseComponentContainer = ComponentContainer<T, SparseComponentIndex>;
+
 } //end namespace ecs;
 } //end namespace rkg;
\ No newline at end of file
@@ -0,0 +1,36 @@
+#include "Events.h"
+
+namespace rkg
+{
+namespace ecs
+{
+
+namespace {
+	//Channels are made and destroyed on the main thread, so the list isn't locked.
+	std::vector<EventChannelBase*>& GetChannels()
+	{
+		static std::vector<EventChannelBase*> channels;
+		return channels;
+	}
+}
+
+EventChannelBase::EventChannelBase()
+{
+	GetChannels().push_back(this);
+}
+
+EventChannelBase::~EventChannelBase()
+{
+	auto& channels = GetChannels();
+	channels.erase(std::remove(channels.begin(), channels.end(), this), channels.end());
+}
+
+void FlushEventChannels()
+{
+	for (auto channel : GetChannels()) {
+		channel->Flush();
+	}
+}
+
+} //end namespace ecs;
+} //end namespace rkg;
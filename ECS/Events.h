@@ -0,0 +1,195 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <new>
+#include <cstddef>
+
+#include "ECS/JobSystem.h"
+#include "Utilities/Utilities.h"
+#include "Utilities/Allocators.h"
+
+namespace rkg
+{
+namespace ecs
+{
+
+/*
+	Typed channels for systems to message each other, instead of sharing globals:
+		EventChannel<CollisionEvent> collisions; //Owned by whoever sends them.
+		collisions.Send({ a, b });               //Any job, any thread.
+		collisions.ForEach([](const CollisionEvent& e) { ... }); //Next frame.
+	Events are double buffered. Everything sent during a frame becomes readable at the start of the next one,
+	when the frame loop calls FlushEventChannels - so every reader sees the same events, whichever order systems
+	run in, and reading never races with sending.
+	Each job thread appends to its own list of blocks, so sending takes no locks and doesn't contend with other
+	threads. Blocks are kept and reused from frame to frame, so once they've grown to fit a frame's events,
+	sending doesn't allocate. Events from one thread are read in the order they were sent; there's no order
+	between threads.
+	Channels are flushed without being destroyed, so events need to be trivially destructible.
+*/
+
+class EventChannelBase
+{
+public:
+	EventChannelBase();
+	virtual ~EventChannelBase();
+	EventChannelBase(const EventChannelBase&) = delete;
+	EventChannelBase& operator=(const EventChannelBase&) = delete;
+
+	//Makes the events sent since the last flush readable, and drops the ones that were being read.
+	virtual void Flush() = 0;
+};
+
+//Flushes every channel. Called by the frame loop at the start of each frame, while no jobs are running.
+void FlushEventChannels();
+
+template<typename T>
+class EventChannel : public EventChannelBase
+{
+public:
+	static_assert(std::is_trivially_destructible<T>::value, "Events are dropped without being destroyed.");
+	static_assert(alignof(T) <= alignof(std::max_align_t), "Event blocks are only aligned to max_align_t.");
+
+	EventChannel();
+	~EventChannel() override;
+
+	//Safe to call from any job, concurrently. Readable after the next flush.
+	void Send(const T& event);
+
+	//Reading - the events sent before the last flush.
+	size_t Size() const;
+	bool Empty() const { return Size() == 0; }
+	//fn(const T& event) for every event.
+	template<typename Fn>
+	void ForEach(Fn&& fn) const;
+	//fn(const T* events, size_t count) for each contiguous run of events.
+	template<typename Fn>
+	void ForEachBatch(Fn&& fn) const;
+
+	void Flush() override;
+
+private:
+	static constexpr size_t BLOCK_SIZE{ KILO(16) };
+	static constexpr size_t EVENTS_PER_BLOCK{ BLOCK_SIZE / sizeof(T) > 0 ? BLOCK_SIZE / sizeof(T) : 1 };
+
+	struct ThreadBuffer
+	{
+		std::vector<MemoryBlock> blocks; //Kept between frames.
+		size_t current_block{ 0 };
+		size_t used{ 0 }; //Events in the current block. Blocks before it are full.
+		char padding[64]; //Keeps each thread's buffer off the others' cache lines.
+	};
+
+	//[0] and [1] take turns being written and read.
+	std::vector<ThreadBuffer> buffers_[2];
+	int write_{ 0 };
+	Mallocator allocator_;
+
+	void Resize(std::vector<ThreadBuffer>& buffers);
+};
+
+template<typename T>
+EventChannel<T>::EventChannel()
+{
+	Resize(buffers_[0]);
+	Resize(buffers_[1]);
+}
+
+template<typename T>
+EventChannel<T>::~EventChannel()
+{
+	for (auto& buffers : buffers_) {
+		for (auto& buffer : buffers) {
+			for (auto& block : buffer.blocks) {
+				allocator_.Deallocate(block);
+			}
+		}
+	}
+}
+
+//Channels are usually made before the worker threads start, so they catch up with the thread count on flush.
+template<typename T>
+void EventChannel<T>::Resize(std::vector<ThreadBuffer>& buffers)
+{
+	const size_t num_threads = static_cast<size_t>(std::max(GetNumJobThreads(), 1));
+	if (buffers.size() < num_threads) {
+		buffers.resize(num_threads);
+	}
+}
+
+template<typename T>
+void EventChannel<T>::Send(const T& event)
+{
+	auto& buffers = buffers_[write_];
+	const int thread = GetThreadIndex();
+	Expects(thread != EXTERNAL_THREAD_INDEX && thread < static_cast<int>(buffers.size()) && "Only job threads can send events.");
+	auto& buffer = buffers[thread];
+
+	if (buffer.blocks.empty() || buffer.used == EVENTS_PER_BLOCK) {
+		if (!buffer.blocks.empty()) {
+			buffer.current_block++;
+		}
+		if (buffer.current_block == buffer.blocks.size()) {
+			auto block = allocator_.Allocate(EVENTS_PER_BLOCK * sizeof(T));
+			ASSERT(block.ptr != nullptr && "Failed to allocate event block!");
+			buffer.blocks.push_back(block);
+		}
+		buffer.used = 0;
+	}
+	new(static_cast<T*>(buffer.blocks[buffer.current_block].ptr) + buffer.used) T(event);
+	buffer.used++;
+}
+
+template<typename T>
+size_t EventChannel<T>::Size() const
+{
+	size_t size = 0;
+	for (auto& buffer : buffers_[write_ ^ 1]) {
+		size += buffer.current_block * EVENTS_PER_BLOCK + buffer.used;
+	}
+	return size;
+}
+
+template<typename T>
+template<typename Fn>
+void EventChannel<T>::ForEachBatch(Fn&& fn) const
+{
+	for (auto& buffer : buffers_[write_ ^ 1]) {
+		if (buffer.blocks.empty()) {
+			continue;
+		}
+		for (size_t i = 0; i < buffer.current_block; i++) {
+			fn(static_cast<const T*>(buffer.blocks[i].ptr), EVENTS_PER_BLOCK);
+		}
+		if (buffer.used > 0) {
+			fn(static_cast<const T*>(buffer.blocks[buffer.current_block].ptr), buffer.used);
+		}
+	}
+}
+
+template<typename T>
+template<typename Fn>
+void EventChannel<T>::ForEach(Fn&& fn) const
+{
+	ForEachBatch([&fn](const T* events, size_t count) {
+		for (size_t i = 0; i < count; i++) {
+			fn(events[i]);
+		}
+	});
+}
+
+template<typename T>
+void EventChannel<T>::Flush()
+{
+	write_ ^= 1;
+	auto& buffers = buffers_[write_];
+	Resize(buffers);
+	for (auto& buffer : buffers) {
+		buffer.current_block = 0;
+		buffer.used = 0;
+	}
+}
+
+} //end namespace ecs;
+} //end namespace rkg;
@@ -7,88 +7,175 @@
 #include <vector>
 #include <algorithm>
 #include <memory>
-#include <array>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
 #include "Utilities\Utilities.h"
 #include "Utilities\Allocators.h"
 
+#include <Windows.h>
+
 namespace rkg {
 	namespace ecs {
 
+//Intrusive list node linking a job to one of the jobs that depend on it.
+//Allocated from the job allocators, so it lives as long as the job it's attached to.
+//Something to do when a job finishes - either resolve one of another job's dependencies, or decrement a counter.
+struct Continuation
+{
+	Job* job;
+	JobCounter* counter;
+	Continuation* next;
+};
+
 namespace {
 	static constexpr auto SIZE = sizeof(Job);
 	static constexpr auto CACHE_SIZE = 64;
 
 	static_assert(SIZE - CACHE_SIZE == 0, "Need to adjust padding of Job!");
 
-	static constexpr size_t MAX_NUM_JOBS = MEGA(4);
+	static constexpr size_t MAX_NUM_JOBS = MEGA(4); //256 MB of job memory per thread, which JobSystem.h and ParallelAlgorithms.h mention.
 
 	class alignas(64) JobQueue
 	{
 		/*
-		Lock-free queue.
+		Lock-free work-stealing deque (Chase-Lev).
 		Assumptions: Pop and Push are only
 		called by one thread.
 		Steal is called by any other thread.
+
+		Memory orderings follow Le et al, "Correct and Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013),
+		so the common Push/Pop path has no locked instructions, and nothing stronger than it needs on ARM.
+
+		The buffer is circular, starts small and doubles when it fills up. A thief may still be reading 
+		from the old buffer after it's replaced, so old buffers are retired rather than freed, and only released with the queue.
+		Indices are 64 bit and never reset, so they won't wrap.
 		*/
 	private:
+		static constexpr int64_t INITIAL_CAPACITY{ 256 };
+
+		struct Buffer
+		{
+			int64_t capacity;
+			Buffer* retired; //The smaller buffer this one replaced.
+			std::atomic<Job*> jobs[1]; //Actually capacity entries long.
+
+			inline Job* Get(int64_t i) const
+			{
+				return jobs[i & (capacity - 1)].load(std::memory_order_relaxed);
+			}
+
+			inline void Put(int64_t i, Job* job)
+			{
+				jobs[i & (capacity - 1)].store(job, std::memory_order_relaxed);
+			}
+		};
+
+		alignas(64) std::atomic<int64_t> top_{ 0 };
+		alignas(64) std::atomic<int64_t> bottom_{ 0 };
+		std::atomic<Buffer*> buffer_{ nullptr };
+		Mallocator allocator_;
+
+		Buffer* AllocateBuffer(int64_t capacity)
+		{
+			auto block = allocator_.Allocate(sizeof(Buffer) + (capacity - 1) * sizeof(std::atomic<Job*>));
+			ASSERT(block.ptr != nullptr && "Job queue failed to allocate!!");
+			Buffer* buffer = static_cast<Buffer*>(block.ptr);
+			buffer->capacity = capacity;
+			buffer->retired = nullptr;
+			return buffer;
+		}
+
+		Buffer* Grow(Buffer* old_buffer, int64_t top, int64_t bottom)
+		{
+			Buffer* buffer = AllocateBuffer(old_buffer->capacity * 2);
+			for (int64_t i = top; i < bottom; i++) {
+				buffer->Put(i, old_buffer->Get(i));
+			}
+			buffer->retired = old_buffer;
+			return buffer;
+		}
 
-		//TODO: Replace this with a linear allocator.
-		std::array<Job*, MAX_NUM_JOBS> data_;
-		static constexpr auto MASK = MAX_NUM_JOBS - 1;
-		std::atomic<int> bottom_;
-		std::atomic<int> top_;
 	public:
+		JobQueue()
+		{
+			buffer_.store(AllocateBuffer(INITIAL_CAPACITY), std::memory_order_relaxed);
+		}
+
+		~JobQueue()
+		{
+			Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+			while (buffer) {
+				Buffer* retired = buffer->retired;
+				allocator_.Deallocate({ buffer, sizeof(Buffer) + (buffer->capacity - 1) * sizeof(std::atomic<Job*>) });
+				buffer = retired;
+			}
+		}
+
+		JobQueue(const JobQueue&) = delete;
+		JobQueue& operator=(const JobQueue&) = delete;
+
 		Job* Pop()
 		{
-			auto b = bottom_.load() - 1;
-			bottom_.store(b);
+			auto b = bottom_.load(std::memory_order_relaxed) - 1;
+			Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+			bottom_.store(b, std::memory_order_relaxed);
+			//Publishing the new bottom has to happen before we read top, or a thief and us could both take the last job.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
 
-			auto t = top_.load();
+			auto t = top_.load(std::memory_order_relaxed);
 			if (t <= b)
 			{
-				auto job = data_[b & MASK];
+				auto job = buffer->Get(b);
 				if (t != b) {
 					return job;
 				}
-				//This is the last item in the queue.
-				if (top_.compare_exchange_strong(t, t + 1))
-				{ //Compare succeeded, we got the last item.
-					bottom_ = t + 1;
-					return job;
-				}
-				else
+				//This is the last item in the queue - race any thieves for it.
+				if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
 				{
 					//Compare failed, which means a steal has incremented top_.
-					//Since the compare/exchange incremented t, we just do this.
-					bottom_.store(t);
-					return nullptr;
+					job = nullptr;
 				}
+				bottom_.store(b + 1, std::memory_order_relaxed);
+				return job;
 			}
 			else
 			{
-				bottom_.store(t);//Queue was already empty
+				bottom_.store(b + 1, std::memory_order_relaxed);//Queue was already empty
 				return nullptr;
 			}
 		}
 
 		void Push(Job* job)
 		{
-			auto b = bottom_.load();
-			data_[b  & MASK] = job;
-			bottom_.store(b + 1);
+			auto b = bottom_.load(std::memory_order_relaxed);
+			auto t = top_.load(std::memory_order_acquire);
+			Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+			if (b - t > buffer->capacity - 1) {
+				//Full.
+				buffer = Grow(buffer, t, b);
+				buffer_.store(buffer, std::memory_order_release);
+			}
+			buffer->Put(b, job);
+			//The job must be visible before a thief can see the new bottom.
+			std::atomic_thread_fence(std::memory_order_release);
+			bottom_.store(b + 1, std::memory_order_relaxed);
 		}
 
 		Job* Steal()
 		{
-			auto t = top_.load();
-			auto b = bottom_.load();
+			auto t = top_.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			auto b = bottom_.load(std::memory_order_acquire);
 			if (t < b)
 			{
-				Job* job = data_[t & MASK];
+				Buffer* buffer = buffer_.load(std::memory_order_acquire);
+				Job* job = buffer->Get(t);
 
 				//If someone else has stolen already, this will fail.
-				if (!top_.compare_exchange_strong(t, t + 1))
+				if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
 				{
 					return nullptr;
 				}
@@ -100,75 +187,492 @@ namespace {
 			}
 		}
 
+		//Approximate - only used to decide whether it's safe for an idle worker to go to sleep.
+		bool Empty() const
+		{
+			return top_.load(std::memory_order_relaxed) >= bottom_.load(std::memory_order_relaxed);
+		}
+
+		//Approximate, for the same reason. Used to size steal batches.
+		int64_t Size() const
+		{
+			return std::max<int64_t>(bottom_.load(std::memory_order_relaxed) - top_.load(std::memory_order_relaxed), 0);
+		}
+
 		//Assumes that all jobs are executed already - happens at end of a frame.
+		//Can be called from any thread, not just the owner.
 		void Clear()
 		{
-			//This can be called while both Pop and Steal are being called. 
-			//So it needs to make sure those stay valid. 
+			//This can be called while Steal is being called, so rather than resetting the indices 
+			//(which would let a stale thief succeed its compare/exchange), just steal anything left over.
+			while (!Empty()) {
+				Steal();
+			}
+		}
+
+	};
+
+	/*
+	Queue for jobs pinned to a thread, or submitted from a thread outside the worker pool.
+	Any thread can push, and these are rare enough that a lock is fine.
+	*/
+	class LockedJobQueue
+	{
+	private:
+		std::mutex mutex_;
+		std::deque<Job*> jobs_;
+		std::atomic<size_t> size_{ 0 };
+	public:
+		void Push(Job* job)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			jobs_.push_back(job);
+			size_.store(jobs_.size(), std::memory_order_relaxed);
+		}
+
+		Job* Pop()
+		{
+			if (Empty()) {
+				return nullptr;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (jobs_.empty()) {
+				return nullptr;
+			}
+			Job* job = jobs_.front();
+			jobs_.pop_front();
+			size_.store(jobs_.size(), std::memory_order_relaxed);
+			return job;
+		}
 
-			bottom_.store(0);
-			top_.store(0);
+		bool Empty() const
+		{
+			return size_.load(std::memory_order_relaxed) == 0;
 		}
 
+		void Clear()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			jobs_.clear();
+			size_.store(0, std::memory_order_relaxed);
+		}
 	};
 
+	static constexpr int NUM_PRIORITIES{ static_cast<int>(JobPriority::COUNT) };
+
 	using JobAllocator = rkg::GrowingLinearAllocator<MAX_NUM_JOBS * sizeof(Job)>;
-	std::unique_ptr<JobQueue[]> job_queues;
+	std::unique_ptr<JobQueue[]> job_queues; //One per priority, for each thread.
 	std::unique_ptr<JobAllocator[]> job_allocators;
-	int num_job_queues;
+	//Background jobs, and anything they allocate, outlive the frame, so they share an allocator which is 
+	//only reset once none of them are left. Allocations are rare enough that a lock is fine.
+	std::unique_ptr<JobAllocator> background_allocator;
+	std::mutex background_mutex;
+	std::atomic_int live_background_jobs{ 0 }; //Submitted and not yet finished.
+	std::vector<std::thread> worker_threads;
+	LockedJobQueue shared_queues[NUM_PRIORITIES]; //Jobs submitted from threads outside the pool.
+	LockedJobQueue pinned_queues[static_cast<int>(JobThread::COUNT)];
+	int num_threads;
 	thread_local int thread_index{ 0 };
+	thread_local JobThread current_thread{ JobThread::ANY };
+	thread_local JobPriority running_priority{ JobPriority::NORMAL };
+	std::atomic_int running_background_jobs{ 0 };
+	int max_background_workers; //Zero or less if no worker can be spared.
+
+	inline JobQueue& GetQueue(int thread, JobPriority priority)
+	{
+		return job_queues[thread * NUM_PRIORITIES + static_cast<int>(priority)];
+	}
 	std::atomic_bool workers_running{ false };
-	std::atomic_int clear_workers{ 0 };
 
-	unsigned int GetRandomThreadIndex(const int num_threads)
+	/*
+	At ClearJobs, each worker releases its own frame memory once it runs out of jobs. A worker that's busy with 
+	a background job doesn't touch its frame memory, so ClearJobs does it for that worker instead of waiting 
+	for the job to finish. Whichever of the two claims the request first does the clearing.
+	*/
+	enum ClearState : int
 	{
-		//Borrowed from Stack overflow http://stackoverflow.com/questions/1640258/need-a-fast-random-generator-for-c
-		static unsigned long x = 123456789, y = 362436069, z = 521288629;
+		CLEAR_NONE,
+		CLEAR_REQUESTED,
+		CLEAR_CLAIMED
+	};
 
-		unsigned long t;
-		x ^= x << 16;
-		x ^= x >> 5;
-		x ^= x << 1;
+	struct alignas(64) WorkerFrameState
+	{
+		std::atomic_int clear_state{ CLEAR_NONE };
+		std::atomic_bool in_background_job{ false };
+	};
 
-		t = x;
-		x = y;
-		y = z;
-		z = t ^ x ^ y;
+	std::unique_ptr<WorkerFrameState[]> worker_frame_states;
 
-		return z % num_threads;
+	bool TryClaimClear(int index)
+	{
+		int expected = CLEAR_REQUESTED;
+		return worker_frame_states[index].clear_state.compare_exchange_strong(expected, CLEAR_CLAIMED, std::memory_order_acq_rel);
 	}
 
-	Job* GetJob()
+	inline void SetRunningPriority(JobPriority priority)
 	{
-		//Grab a job from the queue, or steal from another thread if none available.
-		Job* job = job_queues[thread_index].Pop();
+		running_priority = priority;
+		if (thread_index != EXTERNAL_THREAD_INDEX) {
+			worker_frame_states[thread_index].in_background_job.store(priority == JobPriority::BACKGROUND, std::memory_order_relaxed);
+		}
+	}
 
-		if (!job) {
+	/*
+	Idle workers back off in stages: spin for a little while (new work usually shows up within a few microseconds 
+	while a frame is in flight), then yield, then park on a condition variable until SubmitJob wakes them up.
+	*/
+	static constexpr int IDLE_SPIN_ROUNDS{ 64 };
+	static constexpr int IDLE_PAUSES_PER_SPIN{ 32 };
+	static constexpr int IDLE_YIELD_ROUNDS{ 16 };
+	static constexpr auto MAX_PARK_TIME = std::chrono::milliseconds(100);
 
+	using Clock = std::chrono::steady_clock;
 
-			int random_index = GetRandomThreadIndex(num_job_queues); //Should probably randomize this properly.
+	//Only ever written by the owning thread, but can be read from anywhere for the profiler.
+	struct alignas(64) WorkerCounters
+	{
+		std::atomic<uint64_t> jobs_executed{ 0 };
+		std::atomic<uint64_t> jobs_stolen{ 0 };
+		std::atomic<uint64_t> failed_steals{ 0 };
+		std::atomic<uint64_t> idle_ns{ 0 };
+		std::atomic<uint64_t> parked_ns{ 0 };
+		std::atomic<uint64_t> times_parked{ 0 };
+		std::atomic<uint64_t> times_woken{ 0 };
+		std::atomic<uint64_t> total_wake_latency_ns{ 0 };
+		std::atomic<uint64_t> max_wake_latency_ns{ 0 };
+		std::atomic<uint64_t> last_frame_allocated_bytes{ 0 }; //Written by whichever thread clears the frame.
+	};
 
-			if (random_index == thread_index) {
-				using namespace std::chrono_literals;
-				std::this_thread::sleep_for(1ms);
-				//std::this_thread::yield();
-				return nullptr;
+	std::unique_ptr<WorkerCounters[]> worker_counters;
+
+	//Single writer, so there's no need for a locked read-modify-write.
+	inline void AddToCounter(std::atomic<uint64_t>& counter, uint64_t value)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+
+	inline uint64_t NanosecondsSince(Clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+	}
+	std::mutex park_mutex;
+	std::condition_variable park_condition;
+	uint32_t wake_epoch{ 0 }; //Guarded by park_mutex.
+	std::atomic_int parked_workers{ 0 };
+	std::atomic<Clock::rep> last_wake_request{ 0 };
+
+	/*
+	Fibers: in fiber mode, workers run their loop on fibers from a pool. When a job running on one of them 
+	has to wait, the fiber goes on a wait list and the worker carries on with a fresh fiber, instead of 
+	running other jobs on top of the waiting one's stack. Whichever worker next notices that the wait is
+	over switches to the waiting fiber, so the rest of the job may run on a different thread.
+	Only the workers do this - the main thread and pinned threads still run other jobs while waiting,
+	since what's further down their stacks (the game loop, the render loop) can't move to another thread.
+	*/
+	static constexpr size_t FIBER_STACK_SIZE{ KILO(128) };
+	static constexpr size_t MAX_FIBERS{ 256 };
+
+	struct WaitCondition
+	{
+		const Job* job; //Either a job to finish...
+		const JobCounter* counter; //...or a counter to reach value.
+		int32_t value;
+
+		bool Done() const
+		{
+			return job ? job->unfinished_jobs == -1 : counter->value.load(std::memory_order_acquire) <= value;
+		}
+	};
+
+	struct WaitingFiber
+	{
+		void* fiber;
+		WaitCondition condition;
+	};
+
+	//What to do with the fiber we've just switched away from. 
+	enum class FiberSwitchAction
+	{
+		NONE,
+		RELEASE, //Back to the pool.
+		WAIT //On to the wait list.
+	};
+
+	bool use_fibers{ false };
+	std::mutex fiber_mutex;
+	std::vector<void*> all_fibers; //Guarded by fiber_mutex.
+	std::vector<void*> free_fibers; //Guarded by fiber_mutex.
+	std::vector<WaitingFiber> waiting_fibers; //Guarded by fiber_mutex.
+	std::atomic_int num_waiting_fibers{ 0 };
+
+	thread_local bool is_fiber_worker{ false };
+	thread_local void* thread_fiber{ nullptr }; //The worker thread itself, converted to a fiber.
+	thread_local void* switch_from{ nullptr };
+	thread_local FiberSwitchAction switch_action{ FiberSwitchAction::NONE };
+	thread_local WaitCondition switch_condition;
+
+	bool AnyWaitingFiberReady()
+	{
+		if (num_waiting_fibers.load(std::memory_order_relaxed) == 0) {
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(fiber_mutex);
+		for (const auto& waiting : waiting_fibers) {
+			if (waiting.condition.Done()) {
+				return true;
 			}
-			else {
-				job = job_queues[random_index].Steal(); //Try to steal. 
-				if (!job) {
-					return nullptr;
+		}
+		return false;
+	}
+
+	void WakeWorkers(bool wake_all)
+	{
+		last_wake_request.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+		{
+			std::lock_guard<std::mutex> lock(park_mutex);
+			++wake_epoch;
+		}
+
+		if (wake_all) {
+			park_condition.notify_all();
+		}
+		else {
+			park_condition.notify_one();
+		}
+	}
+
+	//Call after queueing jobs. Pairs with the fence in Park - makes sure a worker going to sleep either sees the new jobs, or is seen here.
+	void WakeParkedWorker()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (parked_workers.load(std::memory_order_relaxed) > 0) {
+			WakeWorkers(false);
+		}
+	}
+
+	//Background jobs only count while there's a free background worker slot to run them with. Otherwise 
+	//there's nothing we could take, and whoever frees a slot carries on with the next background job itself.
+	bool AnyQueueHasWork()
+	{
+		const bool can_run_background = running_background_jobs.load(std::memory_order_relaxed) < max_background_workers;
+		const int num_priorities = can_run_background ? NUM_PRIORITIES : static_cast<int>(JobPriority::BACKGROUND);
+		for (int i = 0; i < num_threads; i++) {
+			for (int p = 0; p < num_priorities; p++) {
+				if (!GetQueue(i, static_cast<JobPriority>(p)).Empty()) {
+					return true;
 				}
-				else {
-					return job;
+			}
+		}
+		for (int p = 0; p < num_priorities; p++) {
+			if (!shared_queues[p].Empty()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Park()
+	{
+		auto& counters = worker_counters[thread_index];
+		std::unique_lock<std::mutex> lock(park_mutex);
+
+		//Announce that we're going to sleep before the final check of the queues. 
+		//Pairs with the fence in SubmitJob, so either we see the new job or the submitter sees us.
+		parked_workers.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		auto& clear_state = worker_frame_states[thread_index].clear_state;
+		if (workers_running && clear_state != CLEAR_REQUESTED && !AnyQueueHasWork() && !AnyWaitingFiberReady()) {
+			const uint32_t epoch = wake_epoch;
+			const auto park_start = Clock::now();
+			AddToCounter(counters.times_parked, 1);
+
+			park_condition.wait_for(lock, MAX_PARK_TIME, [epoch, &clear_state]() {
+				return wake_epoch != epoch || !workers_running || clear_state == CLEAR_REQUESTED;
+			});
+
+			AddToCounter(counters.parked_ns, NanosecondsSince(park_start));
+			if (wake_epoch != epoch) {
+				const uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+					Clock::now().time_since_epoch() - Clock::duration(last_wake_request.load(std::memory_order_relaxed))).count();
+				AddToCounter(counters.times_woken, 1);
+				AddToCounter(counters.total_wake_latency_ns, latency);
+				if (latency > counters.max_wake_latency_ns.load(std::memory_order_relaxed)) {
+					counters.max_wake_latency_ns.store(latency, std::memory_order_relaxed);
 				}
+			}
+		}
+
+		parked_workers.fetch_sub(1, std::memory_order_relaxed);
+	}
 
+	void Idle(int idle_rounds)
+	{
+		if (idle_rounds < IDLE_SPIN_ROUNDS) {
+			for (int i = 0; i < IDLE_PAUSES_PER_SPIN; i++) {
+				_mm_pause();
 			}
 		}
+		else if (idle_rounds < IDLE_SPIN_ROUNDS + IDLE_YIELD_ROUNDS) {
+			std::this_thread::yield();
+		}
 		else {
-			return job;
+			Park();
+		}
+	}
+
+	//Each thread has its own generator state - sharing one made every worker write to (and race on) the same cache line.
+	thread_local uint32_t random_state{ 2463534242u };
+	static constexpr int64_t MAX_STEAL_BATCH{ 32 };
+
+	unsigned int GetRandomThreadIndex(const int num_threads)
+	{
+		//xorshift32, from Marsaglia's "Xorshift RNGs".
+		uint32_t x = random_state;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		random_state = x;
+
+		return x % num_threads;
+	}
+
+	//Picks a random queue other than our own.
+	int GetRandomVictimIndex()
+	{
+		int index = GetRandomThreadIndex(num_threads - 1);
+		return (index >= thread_index) ? index + 1 : index;
+	}
+
+	Job* StealBatch(int victim_index, JobPriority priority)
+	{
+		/*
+		Takes up to half of the victim's queue in one visit. The first job is returned to be run,
+		the rest are moved over to our own queue, so we work through them locally instead of 
+		coming back to the victim's top_ for each one, and other idle workers can steal them from us.
+		Each job is taken with a regular single Steal - taking a range with one compare/exchange 
+		isn't safe against the owner's Pop, which doesn't synchronize unless it's taking the last job.
+		Making Pop synchronize near the top would cost it a locked instruction (and its LIFO order) 
+		whenever the queue is short, which is most of the time.
+		The extras go straight onto our own queue, with at most one wake-up for the whole batch.
+		*/
+		auto& victim = GetQueue(victim_index, priority);
+		auto& counters = worker_counters[thread_index];
+		Job* job = victim.Steal();
+		if (!job) {
+			AddToCounter(counters.failed_steals, 1);
+			return nullptr;
+		}
+
+		uint64_t num_stolen = 1;
+		const int64_t batch_size = std::min(victim.Size() / 2, MAX_STEAL_BATCH - 1);
+		for (int64_t i = 0; i < batch_size; i++) {
+			Job* extra = victim.Steal();
+			if (!extra) {
+				break;
+			}
+			GetQueue(thread_index, priority).Push(extra);
+			num_stolen++;
+		}
+		if (num_stolen > 1) {
+			WakeParkedWorker();
+		}
+
+		AddToCounter(counters.jobs_stolen, num_stolen);
+		return job;
+	}
+
+	Job* GetJob(JobPriority lowest_priority)
+	{
+		//Jobs pinned to this thread come first - nobody else can run them.
+		if (current_thread != JobThread::ANY) {
+			Job* job = pinned_queues[static_cast<int>(current_thread)].Pop();
+			if (job || thread_index == EXTERNAL_THREAD_INDEX) {
+				return job;
+			}
+		}
+
+		//Then, in priority order: grab a job from our queue, one submitted from outside the pool, 
+		//or steal from another thread if none available. Our own queues are checked first, so we 
+		//don't pay for a steal attempt on every job just because there's nothing critical around.
+		for (int p = 0; p <= static_cast<int>(lowest_priority); p++) {
+			if (Job* job = GetQueue(thread_index, static_cast<JobPriority>(p)).Pop()) {
+				return job;
+			}
+		}
+		for (int p = 0; p <= static_cast<int>(lowest_priority); p++) {
+			if (Job* job = shared_queues[p].Pop()) {
+				return job;
+			}
+		}
+		if (num_threads > 1) {
+			for (int p = 0; p <= static_cast<int>(lowest_priority); p++) {
+				if (Job* job = StealBatch(GetRandomVictimIndex(), static_cast<JobPriority>(p))) {
+					return job;
+				}
+			}
+		}
+
+		//Backing off when there's nothing to steal is left to the caller.
+		return nullptr;
+	}
+
+	//Background jobs can run for a long time, so they're limited to a subset of the workers.
+	bool TryReserveBackgroundWorker()
+	{
+		if (running_background_jobs.fetch_add(1, std::memory_order_relaxed) < max_background_workers) {
+			return true;
 		}
+		running_background_jobs.fetch_sub(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	//Stored in a job's continuation list once it has finished, so late additions know to submit right away.
+	Continuation finished_list_marker;
+
+	MemoryBlock AllocateJobMemory(size_t size, bool background)
+	{
+		if (background) {
+			std::lock_guard<std::mutex> lock(background_mutex);
+			return background_allocator->Allocate(size);
+		}
+		return job_allocators[thread_index].Allocate(size);
+	}
+
+	bool IsBackgroundMemory(const void* ptr)
+	{
+		const char* begin = background_allocator->Begin();
+		return ptr >= begin && ptr < begin + MAX_NUM_JOBS * sizeof(Job);
+	}
+
+	//Adds a continuation to j's list. Returns false if j has already finished, in which case nothing was added.
+	bool AddContinuation(Job* j, Job* continuation_job, JobCounter* counter)
+	{
+		//Lives as long as j does.
+		const bool background = j->priority == JobPriority::BACKGROUND || running_priority == JobPriority::BACKGROUND;
+		auto block = AllocateJobMemory(sizeof(Continuation), background);
+		ASSERT(block.ptr != nullptr && "Continuation failed to allocate!!");
+
+		Continuation* node = new(block.ptr) Continuation{ continuation_job, counter, nullptr };
+		Continuation* head = j->continuations.load(std::memory_order_acquire);
+		while (head != &finished_list_marker) {
+			node->next = head;
+			if (j->continuations.compare_exchange_weak(head, node, 
+				std::memory_order_release, std::memory_order_acquire)) {
+				return true;
+			}
+		}
+		return false;
+	}
 
+	void ResolveDependency(Job* j)
+	{
+		if (j->pending_dependencies.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			SubmitJob(j);
+		}
 	}
 
 	void Finish(Job* j)
@@ -176,85 +680,458 @@ namespace {
 		const int32_t unfinishedJobs = --(j->unfinished_jobs);
 		if (unfinishedJobs == 0)
 		{
+			//Close the continuation list, so anything added from now on gets submitted right away.
+			Continuation* c = j->continuations.exchange(&finished_list_marker, std::memory_order_acq_rel);
+			Job* parent = j->parent;
+			const bool background = j->priority == JobPriority::BACKGROUND;
+
 			//TODO: Add to list of jobs that need to be deleted. Don't actively delete it yet.
-			if (j->parent)
+			//Mark this job as done before releasing anything else - once those run, the frame may finish
+			//and ClearJobs can release this job's memory, so it must not be touched again.
+			--(j->unfinished_jobs);
+
+			while (c) {
+				Continuation* next = c->next;
+				if (c->counter) {
+					c->counter->value.fetch_sub(1, std::memory_order_release);
+				}
+				else {
+					ResolveDependency(c->job);
+				}
+				c = next;
+			}
+
+			//Nothing of j's is touched after this, so its memory can go at the next ClearJobs where no other background jobs are left.
+			if (background) {
+				live_background_jobs.fetch_sub(1, std::memory_order_release);
+			}
+
+			//A suspended fiber may have been waiting on this. Pairs with the fence in Park, like SubmitJob.
+			if (num_waiting_fibers.load(std::memory_order_relaxed) > 0) {
+				WakeParkedWorker();
+			}
+
+			if (parent)
 			{
-				Finish(j->parent);
+				Finish(parent);
 			}
-			--(j->unfinished_jobs);
 		}
 	}
 
 	void Execute(Job* j)
 	{
+		//Jobs can run nested inside another one's Wait, so put back whatever was running before.
+		const JobPriority outer_priority = running_priority;
+		SetRunningPriority(j->priority);
+
 		//Run the job.
 		(j->function)(j->padding, j);
 		Finish(j);
+		SetRunningPriority(outer_priority);
+		if (thread_index != EXTERNAL_THREAD_INDEX) {
+			AddToCounter(worker_counters[thread_index].jobs_executed, 1);
+		}
 	}
 
-}
+	void WINAPI FiberMain(void*);
 
-void InitializeWorkerThreads(int num_workers)
-{
-	num_job_queues = num_workers + 1; //Add one for this thread as well.
-	workers_running = true;
-	job_queues = std::make_unique<JobQueue[]>(num_job_queues);
-	job_allocators = std::make_unique<JobAllocator[]>(num_job_queues);
-	for (int i = 0; i < num_workers; i++) {
-		std::thread worker([](int index) {
-			thread_index = index;
-			while (workers_running) {
-				auto job = GetJob();
-				if (job) {
-					Execute(job);
+	//Only called with fiber_mutex held.
+	void* AcquireFiber()
+	{
+		if (!free_fibers.empty()) {
+			void* fiber = free_fibers.back();
+			free_fibers.pop_back();
+			return fiber;
+		}
+		if (all_fibers.size() >= MAX_FIBERS) {
+			return nullptr;
+		}
+
+		void* fiber = CreateFiber(FIBER_STACK_SIZE, FiberMain, nullptr);
+		if (fiber) {
+			all_fibers.push_back(fiber);
+		}
+		return fiber;
+	}
+
+	//The fiber we switched away from can only be handed to another thread once we're off its stack,
+	//so that's done here, by the fiber we switched to.
+	void CompleteFiberSwitch()
+	{
+		if (switch_action == FiberSwitchAction::RELEASE) {
+			std::lock_guard<std::mutex> lock(fiber_mutex);
+			free_fibers.push_back(switch_from);
+		}
+		else if (switch_action == FiberSwitchAction::WAIT) {
+			std::lock_guard<std::mutex> lock(fiber_mutex);
+			waiting_fibers.push_back(WaitingFiber{ switch_from, switch_condition });
+			num_waiting_fibers.fetch_add(1, std::memory_order_relaxed);
+		}
+		switch_action = FiberSwitchAction::NONE;
+	}
+
+	void SwitchFiber(void* fiber, FiberSwitchAction action)
+	{
+		const JobPriority priority = running_priority;
+		switch_from = GetCurrentFiber();
+		switch_action = action;
+		SwitchToFiber(fiber);
+		//Back again, possibly on another thread.
+		CompleteFiberSwitch();
+		SetRunningPriority(priority);
+	}
+
+	//Puts the current fiber to sleep until the condition is met. Returns false if we're out of fibers,
+	//in which case the caller has to fall back on running other jobs while it waits.
+	bool SuspendFiber(const WaitCondition& condition)
+	{
+		void* next_fiber = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(fiber_mutex);
+			next_fiber = AcquireFiber();
+		}
+		if (!next_fiber) {
+			return false;
+		}
+
+		switch_condition = condition;
+		SwitchFiber(next_fiber, FiberSwitchAction::WAIT);
+		return true;
+	}
+
+	bool ResumeWaitingFiber()
+	{
+		if (num_waiting_fibers.load(std::memory_order_relaxed) == 0) {
+			return false;
+		}
+
+		void* fiber = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(fiber_mutex);
+			for (size_t i = 0; i < waiting_fibers.size(); i++) {
+				if (waiting_fibers[i].condition.Done()) {
+					fiber = waiting_fibers[i].fiber;
+					waiting_fibers[i] = waiting_fibers.back();
+					waiting_fibers.pop_back();
+					num_waiting_fibers.fetch_sub(1, std::memory_order_relaxed);
+					break;
 				}
-				else {
-					if (clear_workers == GetThreadIndex()) {
-						job_queues[GetThreadIndex()].Clear();
-						job_allocators[GetThreadIndex()].DeallocateAll();
-						clear_workers.fetch_sub(1);
+			}
+		}
+		if (!fiber) {
+			return false;
+		}
+
+		//This fiber goes back in the pool - when it's picked up again, it carries on with the worker loop from here.
+		SwitchFiber(fiber, FiberSwitchAction::RELEASE);
+		return true;
+	}
+
+	//Runs other jobs until the condition is met, or suspends the current fiber.
+	void WorkUntil(JobPriority lowest_priority, const WaitCondition& condition)
+	{
+		if (is_fiber_worker && !condition.Done() && SuspendFiber(condition)) {
+			return;
+		}
+
+		bool idle = false;
+		Clock::time_point idle_start;
+		while (!condition.Done()) {
+			//Work the queue.
+			Job* next_job = GetJob(lowest_priority);
+			if (next_job) {
+				if (idle && thread_index != EXTERNAL_THREAD_INDEX) {
+					AddToCounter(worker_counters[thread_index].idle_ns, NanosecondsSince(idle_start));
+				}
+				idle = false;
+				Execute(next_job);
+			}
+			else {
+				if (!idle) {
+					idle_start = Clock::now();
+					idle = true;
+				}
+				_mm_pause();
+			}
+		}
+
+		if (idle && thread_index != EXTERNAL_THREAD_INDEX) {
+			AddToCounter(worker_counters[thread_index].idle_ns, NanosecondsSince(idle_start));
+		}
+	}
+
+	//Background queues are left alone - those jobs carry on into the next frame.
+	void ClearThreadJobs(int index)
+	{
+		for (int p = 0; p < static_cast<int>(JobPriority::BACKGROUND); p++) {
+			GetQueue(index, static_cast<JobPriority>(p)).Clear();
+		}
+		auto& allocator = job_allocators[index];
+		worker_counters[index].last_frame_allocated_bytes.store(allocator.End() - allocator.Begin(), std::memory_order_relaxed);
+		allocator.DeallocateAll();
+	}
+
+	//In fiber mode this can move between threads, so it mustn't hold on to anything thread specific across jobs.
+	void RunWorkerLoop()
+	{
+		int idle_rounds = 0;
+		Clock::time_point idle_start;
+		while (workers_running) {
+			if (ResumeWaitingFiber()) {
+				idle_rounds = 0;
+				continue;
+			}
+
+			auto job = GetJob(JobPriority::NORMAL);
+			if (!job && TryReserveBackgroundWorker()) {
+				job = GetJob(JobPriority::BACKGROUND);
+				if (job && job->priority == JobPriority::BACKGROUND) {
+					if (idle_rounds > 0) {
+						AddToCounter(worker_counters[thread_index].idle_ns, NanosecondsSince(idle_start));
 					}
+					Execute(job);
+					job = nullptr;
+					idle_rounds = 0;
+				}
+				running_background_jobs.fetch_sub(1, std::memory_order_relaxed);
+			}
 
-					std::this_thread::yield();
+			if (job) {
+				if (idle_rounds > 0) {
+					AddToCounter(worker_counters[thread_index].idle_ns, NanosecondsSince(idle_start));
 				}
+				Execute(job);
+				idle_rounds = 0;
 			}
-		}, i + 1);
+			else {
+				if (idle_rounds == 0) {
+					idle_start = Clock::now();
+				}
+				if (TryClaimClear(thread_index)) {
+					ClearThreadJobs(thread_index);
+					worker_frame_states[thread_index].clear_state.store(CLEAR_NONE, std::memory_order_release);
+				}
+
+				Idle(idle_rounds);
+				//After parking, go back to spinning, but keep counting the time as idle.
+				idle_rounds = (idle_rounds < IDLE_SPIN_ROUNDS + IDLE_YIELD_ROUNDS) ? idle_rounds + 1 : 1;
+			}
+		}
+	}
 
-		worker.detach();
+	void WINAPI FiberMain(void*)
+	{
+		CompleteFiberSwitch();
+		SetRunningPriority(JobPriority::NORMAL);
+		RunWorkerLoop();
+		//Shutting down - go back to the thread's own fiber so it can exit. This fiber is never resumed.
+		SwitchToFiber(thread_fiber);
+	}
+
+	void WorkerLoop(int index)
+	{
+		thread_index = index;
+		random_state = 2654435761u * (index + 1);
+		if (use_fibers) {
+			thread_fiber = ConvertThreadToFiber(nullptr);
+			is_fiber_worker = true;
+			void* fiber = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(fiber_mutex);
+				fiber = AcquireFiber();
+			}
+			ASSERT(fiber != nullptr && "Couldn't create a worker fiber!!");
+			SwitchFiber(fiber, FiberSwitchAction::NONE);
+			ConvertFiberToThread();
+		}
+		else {
+			RunWorkerLoop();
+		}
 	}
 
+}
 
+void InitializeWorkerThreads(int num_workers, bool fibers)
+{
+	num_threads = num_workers + 1; //Add one for this thread as well.
+	use_fibers = fibers;
+	max_background_workers = num_workers - 1; //With one worker or none, the main thread runs them from RunPinnedJobs.
+	workers_running = true;
+	current_thread = JobThread::MAIN;
+	job_queues = std::make_unique<JobQueue[]>(num_threads * NUM_PRIORITIES);
+	job_allocators = std::make_unique<JobAllocator[]>(num_threads);
+	background_allocator = std::make_unique<JobAllocator>();
+	worker_counters = std::make_unique<WorkerCounters[]>(num_threads);
+	worker_frame_states = std::make_unique<WorkerFrameState[]>(num_threads);
+	for (int i = 0; i < num_workers; i++) {
+		worker_threads.emplace_back(WorkerLoop, i + 1);
+	}
 }
 
 void ShutdownWorkerThreads()
 {
+	//Wait for the workers to actually stop, so the job system can be started up again (with a different number of workers, for benchmarking).
+	//Any jobs still queued are dropped.
 	workers_running = false;
+	WakeWorkers(true);
+	for (auto& worker : worker_threads) {
+		worker.join();
+	}
+	worker_threads.clear();
+
+	//Anything still suspended is dropped along with the rest of the jobs.
+	for (void* fiber : all_fibers) {
+		DeleteFiber(fiber);
+	}
+	all_fibers.clear();
+	free_fibers.clear();
+	waiting_fibers.clear();
+	num_waiting_fibers = 0;
+
+	for (auto& queue : shared_queues) {
+		queue.Clear();
+	}
+	for (auto& queue : pinned_queues) {
+		queue.Clear();
+	}
+	job_queues.reset();
+	job_allocators.reset();
+	background_allocator.reset();
+	worker_counters.reset();
+	worker_frame_states.reset();
+	running_background_jobs = 0;
+	live_background_jobs = 0;
+	num_threads = 0;
 }
 
 void SubmitJob(Job* j)
 {
+	Expects((j->priority != JobPriority::BACKGROUND || IsBackgroundMemory(j)) && "Background jobs need their priority passed to CreateJob.");
+	Expects((j->priority != JobPriority::BACKGROUND || j->pinned_thread == JobThread::ANY) && "Pinned jobs can't outlive the frame.");
+
+	if (j->priority == JobPriority::BACKGROUND) {
+		//Counted from here rather than at allocation, so a job that's never submitted can't hold up the reset.
+		//Only frame code, or a background job that's still running, submits these - so it's never counted up from zero during ClearJobs.
+		live_background_jobs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	if (j->pinned_thread != JobThread::ANY) {
+		//Only the pinned thread will pick this up, so there's no point waking workers.
+		pinned_queues[static_cast<int>(j->pinned_thread)].Push(j);
+		return;
+	}
+
 	//Add to the queue.
-	job_queues[thread_index].Push(j);
+	if (thread_index == EXTERNAL_THREAD_INDEX) {
+		shared_queues[static_cast<int>(j->priority)].Push(j);
+	}
+	else {
+		GetQueue(thread_index, j->priority).Push(j);
+	}
 
+	WakeParkedWorker();
+}
+
+JobPriority GetCurrentJobPriority()
+{
+	return running_priority;
 }
 
-Job* AllocateJob(int extra_space)
+Job* AllocateJob(int extra_space, JobPriority priority)
 {
-	//For now, just allocate with malloc.
+	Expects(thread_index != EXTERNAL_THREAD_INDEX && "Threads outside the worker pool can't create jobs.");
+	Expects((running_priority != JobPriority::BACKGROUND || priority == JobPriority::BACKGROUND) && "Background jobs can only create background jobs.");
 
-	auto job_block = job_allocators[thread_index].Allocate(rkg::RoundToAligned(sizeof(Job) + extra_space, 64));
-	return reinterpret_cast<Job*>(job_block.ptr);
+	const size_t size = rkg::RoundToAligned(sizeof(Job) + extra_space, 64);
+	MemoryBlock job_block;
+	if (priority == JobPriority::BACKGROUND) {
+		std::lock_guard<std::mutex> lock(background_mutex);
+		job_block = background_allocator->Allocate(size);
+	}
+	else {
+		job_block = job_allocators[thread_index].Allocate(size);
+	}
+
+	if (!job_block.ptr) {
+		return nullptr;
+	}
+	return new(job_block.ptr) Job;
 }
 
-void Wait(Job* j)
+void* AllocateJobScratch(size_t size)
 {
-	while (j->unfinished_jobs != -1) {
-		//Work the queue.
-		Job* next_job = GetJob();
-		if (next_job) {
-			Execute(next_job);
+	Expects(thread_index != EXTERNAL_THREAD_INDEX && "Threads outside the worker pool can't create jobs.");
+
+	auto block = AllocateJobMemory(size, running_priority == JobPriority::BACKGROUND);
+	ASSERT(block.ptr != nullptr && "Job scratch memory failed to allocate!!");
+	return block.ptr;
+}
+
+void SubmitJobAfter(Job* j, Job* const* dependencies, int num_dependencies)
+{
+	Expects(thread_index != EXTERNAL_THREAD_INDEX && "Threads outside the worker pool can't create jobs.");
+	Expects(num_dependencies < INT16_MAX);
+	//Hold one extra reference while registering, so a dependency that finishes part way through can't submit j early.
+	j->pending_dependencies.store(static_cast<int16_t>(num_dependencies + 1), std::memory_order_relaxed);
+
+	for (int i = 0; i < num_dependencies; i++) {
+		Expects((j->priority == JobPriority::BACKGROUND || dependencies[i]->priority != JobPriority::BACKGROUND) && "Only background jobs can depend on background jobs.");
+		if (!AddContinuation(dependencies[i], j, nullptr)) {
+			//Dependency has already finished.
+			ResolveDependency(j);
 		}
 	}
+
+	ResolveDependency(j);
+}
+
+void AttachCounter(Job* j, JobCounter* counter)
+{
+	Expects(thread_index != EXTERNAL_THREAD_INDEX && "Threads outside the worker pool can't create jobs.");
+	counter->value.fetch_add(1, std::memory_order_relaxed);
+	if (!AddContinuation(j, nullptr, counter)) {
+		counter->value.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+void RegisterPinnedThread(JobThread thread)
+{
+	Expects(thread != JobThread::ANY && thread != JobThread::MAIN);
+	thread_index = EXTERNAL_THREAD_INDEX;
+	current_thread = thread;
+}
+
+void RunPinnedJobs(JobThread thread)
+{
+	Expects(thread == current_thread);
+	auto& queue = pinned_queues[static_cast<int>(thread)];
+	while (Job* job = queue.Pop()) {
+		Execute(job);
+	}
+
+	//No worker can be spared for background jobs, so they're run here, between frames.
+	if (thread == JobThread::MAIN && max_background_workers <= 0) {
+		while (Job* job = GetJob(JobPriority::BACKGROUND)) {
+			Execute(job);
+		}
+	}
+}
+
+void Wait(Job* j)
+{
+	//Don't get stuck behind a long background job while the caller is waiting on something more important.
+	const JobPriority lowest_priority = (j->priority == JobPriority::BACKGROUND) ? JobPriority::BACKGROUND : JobPriority::NORMAL;
+	WorkUntil(lowest_priority, WaitCondition{ j, nullptr, 0 });
+}
+
+void WaitForCounter(const JobCounter* counter, int32_t value)
+{
+	WorkUntil(JobPriority::NORMAL, WaitCondition{ nullptr, counter, value });
+}
+
+bool UsingFibers()
+{
+	return use_fibers;
 }
 
 int GetThreadIndex()
@@ -262,24 +1139,81 @@ int GetThreadIndex()
 	return thread_index;
 }
 
-void ClearJobs()
+int GetNumJobThreads()
 {
-	clear_workers.store(num_job_queues - 1);
-	job_queues[GetThreadIndex()].Clear();
-	job_allocators[GetThreadIndex()].DeallocateAll();
-	//printf("Clear_workers:%d", clear_workers.load());
-	while (clear_workers.load() != 0) {
-		std::this_thread::yield();
-	}
+	return num_threads;
+}
+
+WorkerStats GetWorkerStats(int index)
+{
+	Expects(index >= 0 && index < num_threads);
+	const auto& counters = worker_counters[index];
+	auto& allocator = job_allocators[index];
 
+	WorkerStats stats;
+	stats.jobs_executed = counters.jobs_executed.load(std::memory_order_relaxed);
+	stats.jobs_stolen = counters.jobs_stolen.load(std::memory_order_relaxed);
+	stats.failed_steals = counters.failed_steals.load(std::memory_order_relaxed);
+	stats.idle_ns = counters.idle_ns.load(std::memory_order_relaxed);
+	stats.parked_ns = counters.parked_ns.load(std::memory_order_relaxed);
+	stats.times_parked = counters.times_parked.load(std::memory_order_relaxed);
+	stats.times_woken = counters.times_woken.load(std::memory_order_relaxed);
+	stats.total_wake_latency_ns = counters.total_wake_latency_ns.load(std::memory_order_relaxed);
+	stats.max_wake_latency_ns = counters.max_wake_latency_ns.load(std::memory_order_relaxed);
+	stats.allocated_bytes = allocator.End() - allocator.Begin(); //Racy for other threads, but good enough for display.
+	stats.last_frame_allocated_bytes = counters.last_frame_allocated_bytes.load(std::memory_order_relaxed);
+	return stats;
 }
 
-template<typename T>
-Job* ParallelFor(size_t count, T&& fn)
+bool ShouldSplitWork(const Job* j)
 {
+	//An empty queue means thieves have taken everything we've split off so far, so they're probably looking for more.
+	return GetQueue(thread_index, j->priority).Empty() || parked_workers.load(std::memory_order_relaxed) > 0;
+}
 
+size_t GetAutoBatchSize(size_t count)
+{
+	//Aim for several batches per thread so the tail balances out - with lazy splitting, 
+	//a small batch only costs an extra check, not an extra job.
+	static constexpr size_t BATCHES_PER_THREAD{ 16 };
+	return std::max<size_t>(count / (BATCHES_PER_THREAD * num_threads), 1);
+}
 
-	return nullptr;
+void ClearJobs()
+{
+	for (int i = 1; i < num_threads; i++) {
+		worker_frame_states[i].clear_state.store(CLEAR_REQUESTED);
+	}
+	if (parked_workers.load() > 0) {
+		WakeWorkers(true);
+	}
+	ClearThreadJobs(GetThreadIndex());
+	for (int p = 0; p < static_cast<int>(JobPriority::BACKGROUND); p++) {
+		Expects(shared_queues[p].Empty() && "Frame jobs are still queued at ClearJobs.");
+	}
+	for (auto& queue : pinned_queues) {
+		Expects(queue.Empty() && "Pinned jobs are still queued at ClearJobs - run them with RunPinnedJobs first.");
+	}
+
+	for (int i = 1; i < num_threads; i++) {
+		auto& state = worker_frame_states[i];
+		while (state.clear_state.load(std::memory_order_acquire) != CLEAR_NONE) {
+			if (state.in_background_job.load(std::memory_order_relaxed) && TryClaimClear(i)) {
+				ClearThreadJobs(i);
+				state.clear_state.store(CLEAR_NONE, std::memory_order_release);
+			}
+			else {
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	//New background jobs are only submitted by frame code, which is done by now, or by background jobs 
+	//which are still running - so once the count is zero it stays that way. The lock keeps allocations out while we reset.
+	std::lock_guard<std::mutex> lock(background_mutex);
+	if (live_background_jobs.load(std::memory_order_acquire) == 0) {
+		background_allocator->DeallocateAll();
+	}
 }
 
 }
@@ -1,30 +1,121 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 
 namespace rkg {
 namespace ecs
 {
+struct Continuation;
+
+/*
+	Jobs are taken in priority order. CRITICAL is for work the current frame is waiting on,
+	BACKGROUND for things like asset loading, which may take many frames. 
+	Background jobs are never picked up from inside Wait (unless waiting on a background job), 
+	and at least one worker is always kept free of them. With fewer than two workers, no worker runs 
+	them, and the main thread does instead, from RunPinnedJobs.
+
+	Background jobs are allocated separately, and survive ClearJobs until they've all run, so the
+	priority has to be given to CreateJob rather than set afterwards. Anything created while a background 
+	job is running is a background job too. Frame jobs can't depend on background jobs (they'd be gone 
+	by the time the background work is done) - attach a counter to keep track of background work instead.
+	Background memory is kept for jobs that have been submitted, so a background job has to be submitted 
+	before the next ClearJobs, unless it's created by a background job which is still running.
+*/
+enum class JobPriority : uint8_t
+{
+	CRITICAL,
+	NORMAL,
+	BACKGROUND,
+	COUNT
+};
+
+//Threads which can have jobs pinned to them, for work that has to happen on a specific thread (e.g. anything touching the GL context).
+//MAIN is the thread which called InitializeWorkerThreads. Jobs pinned to MAIN are run from Wait and RunPinnedJobs.
+enum class JobThread : uint8_t
+{
+	ANY,
+	MAIN,
+	RENDER,
+	COUNT
+};
+
 struct Job {
-	static constexpr size_t PADDING_SIZE{ 44 };
+	static constexpr size_t PADDING_SIZE{ 32 };
 
 	using JobFn = void(*)(void*, Job*);
 	JobFn function;
 	Job* parent{ nullptr };
 	std::atomic<uint32_t> unfinished_jobs{ 0 }; //Itself, plus any children jobs.
+	std::atomic<int16_t> pending_dependencies{ 0 }; //Jobs that must finish before this one is submitted.
+	JobPriority priority{ JobPriority::NORMAL }; //Inherited by child jobs.
+	JobThread pinned_thread{ JobThread::ANY };
+	std::atomic<Continuation*> continuations{ nullptr }; //Jobs waiting on this one to finish.
 	char padding[PADDING_SIZE];
 };
 
-void InitializeWorkerThreads(int num_workers);
+//With fibers, a job which waits inside a worker is suspended, and picked up again by any worker once the wait is 
+//over, instead of the worker running other jobs on top of it. Jobs have to be fine with moving threads part way through.
+void InitializeWorkerThreads(int num_workers, bool fibers = false);
+//Whether the workers were started with fibers, i.e. whether a job can move threads part way through.
+bool UsingFibers();
+//Stops and joins the workers. Jobs and job memory are released, and InitializeWorkerThreads can be called again afterwards.
 void ShutdownWorkerThreads();
 void SubmitJob(Job* j);
 
+//Called once from a thread outside the worker pool (e.g. the render thread) so it can have jobs pinned to it.
+//Such threads can run pinned jobs, but can't create jobs themselves.
+void RegisterPinnedThread(JobThread thread);
+
+//Runs every job currently pinned to the given thread. Must be called from that thread.
+//On MAIN, this also runs any queued background jobs when there aren't enough workers to spare one for them.
+void RunPinnedJobs(JobThread thread);
+
+//Submits j automatically once all of the given jobs (and their children) have finished, 
+//so chains like cull -> sort -> encode don't need to block a thread in Wait.
+//A job submitted this way must not also be passed to SubmitJob.
+void SubmitJobAfter(Job* j, Job* const* dependencies, int num_dependencies);
+
+inline void SubmitJobAfter(Job* j, Job* dependency)
+{
+	SubmitJobAfter(j, &dependency, 1);
+}
+
+/*
+	Counts unfinished jobs, without needing a parent job to hang them off.
+	Any number of unrelated jobs (or batches, like a ParallelFor root) can be attached to one counter, 
+	and WaitForCounter joins on all of them at once. Counters aren't owned by the job system, so they 
+	can live on the stack or in a system, as long as they outlive the jobs attached to them.
+*/
+struct JobCounter
+{
+	std::atomic<int32_t> value{ 0 };
+};
+
+//Adds one to counter, which is taken off again once j (and its children) finishes. 
+//Can be called before or after j is submitted, but not after j's memory has been released by ClearJobs.
+void AttachCounter(Job* j, JobCounter* counter);
+
+inline void SubmitJob(Job* j, JobCounter* counter)
+{
+	AttachCounter(j, counter);
+	SubmitJob(j);
+}
+
+
+//Priority of the job the calling thread is running, or NORMAL outside of any job. The default for new jobs.
+JobPriority GetCurrentJobPriority();
 
 //This should never be used directly - not part of the public interface really.
-Job* AllocateJob(int extra_space);
+Job* AllocateJob(int extra_space, JobPriority priority);
+
+//Temporary memory for jobs, from the calling thread's job allocator. Like the jobs themselves, 
+//it stays valid until the next ClearJobs (or, from a background job, the first one after all background 
+//jobs have finished), and destructors are never run. Each thread's allocator holds 256 MB a frame, jobs included.
+void* AllocateJobScratch(size_t size);
 
 template<typename T>
-Job* CreateJob(T&& fn)
+Job* CreateJob(T&& fn, JobPriority priority)
 {
 	//Takes any function which has no arguments, and makes a job for it. 
 	//First, we need to allocate the job. 
@@ -33,7 +124,7 @@ Job* CreateJob(T&& fn)
 
 	//We allocate the job starting at the padding, but we may need extra space for larger lambdas (with lots of captures)
 	int extra_space = std::max<int>(sizeof(T) - Job::PADDING_SIZE, 0);
-	Job* job = AllocateJob(extra_space);
+	Job* job = AllocateJob(extra_space, priority);
 
 	ASSERT(job != nullptr && "Job failed to allocate!!");
 
@@ -43,67 +134,120 @@ Job* CreateJob(T&& fn)
 		f->operator()(j);
 	};
 	job->unfinished_jobs = 1;
+	job->priority = priority;
 
 	return job;
 }
 
+template<typename T>
+Job* CreateJob(T&& fn)
+{
+	return CreateJob(std::forward<T>(fn), GetCurrentJobPriority());
+}
+
 template<typename T>
 Job* CreateChildJob(Job* parent, T&& fn)
 {
 	++parent->unfinished_jobs;
-	Job* job = CreateJob(std::forward<T>(fn));
+	Job* job = CreateJob(std::forward<T>(fn), parent->priority);
 	job->parent = parent;
 
 	return job;
 }
 
 
-//DON'T CALL THIS FUNCTION DIRECTLY! NOT PART OF THE PUBLIC INTERFACE!
-template<typename T>
-void ParallelForHelper(Job* j, size_t count, size_t batch_size, size_t offset, T&& fn)
-{
-	if (count > batch_size) {
-		//Split.
-		size_t left_count = count / 2;
-		size_t right_count = count - left_count;
-
-		Job* left = CreateChildJob(j, [=](Job* job) {
-			ParallelForHelper(job, left_count, batch_size, offset, fn);
-		});
+//Pass as the batch size to let ParallelFor pick one based on the number of elements and threads.
+static constexpr size_t AUTO_BATCH_SIZE{ 0 };
 
-		Job* right = CreateChildJob(j, [=](Job* job) {
-			ParallelForHelper(job, right_count, batch_size, offset + left_count, fn);
-		});
+//DON'T CALL THESE FUNCTIONS DIRECTLY! NOT PART OF THE PUBLIC INTERFACE!
+bool ShouldSplitWork(const Job* j);
+size_t GetAutoBatchSize(size_t count);
 
-		SubmitJob(left);
-		SubmitJob(right);
-	}
-	else {
-		//Execute the function.
-		for (int i = 0; i < count; i++) {
-			fn(offset + i);
+template<typename T>
+void ParallelForHelper(Job* j, size_t begin, size_t end, size_t batch_size, const T* fn)
+{
+	//Lazy binary splitting: work through the range a batch at a time, and only split off the upper half
+	//when other threads look like they need work. Loops that nobody steals from never create more jobs.
+	while (end - begin > batch_size) {
+		if (ShouldSplitWork(j)) {
+			size_t middle = begin + (end - begin) / 2;
+			Job* right = CreateChildJob(j, [=](Job* job) {
+				ParallelForHelper(job, middle, end, batch_size, fn);
+			});
+			SubmitJob(right);
+			end = middle;
 		}
+		else {
+			for (size_t i = begin; i < begin + batch_size; i++) {
+				(*fn)(i);
+			}
+			begin += batch_size;
+		}
+	}
+
+	for (size_t i = begin; i < end; i++) {
+		(*fn)(i);
 	}
-	return;
 }
 
 //Splits a job into a number of batches, to be executed as jobs.
+//The range is only split up as other workers go idle, so batch_size is the smallest unit of work, not the number of jobs.
 template<typename T>
 Job* ParallelFor(size_t count, size_t batch_size, const T& fn)
 {
-	//It would be best to split the job up not all at once, but in parallel, so that it can be separated over multiple queues. 
-	//Right now that isn't possible - may need to change my job system.
+	if (batch_size == AUTO_BATCH_SIZE) {
+		batch_size = GetAutoBatchSize(count);
+	}
 
+	//The function is copied once into the root job. Every split only needs a pointer to it, 
+	//since the root can't finish (and be cleared) before its children do.
 	auto root = CreateJob([=](Job* j) {
-		ParallelForHelper(j, count, batch_size, 0, fn);
+		ParallelForHelper(j, 0, count, batch_size, &fn);
 	});
 	return root;
 }
 
+template<typename T>
+Job* ParallelFor(size_t count, const T& fn)
+{
+	return ParallelFor(count, AUTO_BATCH_SIZE, fn);
+}
+
 void Wait(Job* j);
 
+//Runs other jobs until the counter drops to value (or below).
+void WaitForCounter(const JobCounter* counter, int32_t value = 0);
+
+static constexpr int EXTERNAL_THREAD_INDEX{ -1 };
+//Index of the calling thread in the worker pool, or EXTERNAL_THREAD_INDEX for registered pinned threads outside it.
 int GetThreadIndex();
 
+//Number of threads in the pool, including the main thread (index 0).
+int GetNumJobThreads();
+
+//Counters for one thread, cumulative since InitializeWorkerThreads, except for the allocator numbers.
+//Sample once per frame and diff to get per-frame numbers.
+//Wake latency is measured from the SubmitJob that woke a parked worker, to that worker running again.
+struct WorkerStats
+{
+	uint64_t jobs_executed;
+	uint64_t jobs_stolen;
+	uint64_t failed_steals; //Steal attempts that found the victim's queue empty (or lost the race for the last job).
+	uint64_t idle_ns; //Time spent looking for work without finding any, including time parked.
+	uint64_t parked_ns;
+	uint64_t times_parked;
+	uint64_t times_woken;
+	uint64_t total_wake_latency_ns;
+	uint64_t max_wake_latency_ns;
+	uint64_t allocated_bytes; //Job allocator usage so far this frame.
+	uint64_t last_frame_allocated_bytes; //Job allocator usage at the last ClearJobs.
+};
+
+WorkerStats GetWorkerStats(int thread_index);
+
+//Releases the frame's jobs and job memory, once every frame job has finished. Background jobs are 
+//left queued, and their memory is only released at a ClearJobs where none of them are left.
+//Pinned jobs must all have been run by then.
 void ClearJobs();
 }
 }
\ No newline at end of file
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+
+#include "ECS/JobSystem.h"
+
+/*
+	Parallel algorithms built on the job system.
+	Like ParallelFor, each of these returns a root job which still needs to be submitted, and the
+	results are only valid once it has finished. Any functions passed in are copied, but the data
+	isn't - it has to stay alive until the job is done.
+	Scratch memory comes from the job allocators, so it goes away with the jobs at ClearJobs.
+	It's taken from the calling thread's allocator, which holds at most 256 MB a frame (shared with every
+	other job that thread creates), and running out asserts. ParallelSort needs count * sizeof(T) bytes and
+	ParallelPartition count * (sizeof(T) + 1), so past a few tens of millions of elements, sort in chunks.
+
+	All of these work on blocks: the range is cut into a few blocks per thread, each block is
+	processed serially, and any serial fix-up between passes only touches one value per block.
+*/
+
+namespace rkg {
+namespace ecs
+{
+
+//DON'T CALL THESE FUNCTIONS DIRECTLY! NOT PART OF THE PUBLIC INTERFACE!
+static constexpr size_t MIN_ALGORITHM_BLOCK_SIZE{ 1024 };
+static constexpr size_t ALGORITHM_BLOCKS_PER_THREAD{ 4 };
+
+inline size_t GetAlgorithmBlockSize(size_t count)
+{
+	const size_t num_blocks = ALGORITHM_BLOCKS_PER_THREAD * GetNumJobThreads();
+	return std::max((count + num_blocks - 1) / num_blocks, MIN_ALGORITHM_BLOCK_SIZE);
+}
+
+template<typename T>
+T* AllocateScratchArray(size_t count)
+{
+	static_assert(alignof(T) <= alignof(std::max_align_t), "Job scratch memory isn't aligned for this type.");
+	return static_cast<T*>(AllocateJobScratch(count * sizeof(T)));
+}
+
+template<typename T>
+T* CreateScratchObject(T&& object)
+{
+	using Type = std::decay_t<T>;
+	return new(AllocateScratchArray<Type>(1)) Type(std::forward<T>(object));
+}
+
+//Submits first, then next once first has finished. Next becomes a child of parent, so parent
+//won't finish until both have - this is how the passes of an algorithm are chained together.
+inline void SubmitPass(Job* parent, Job* first, Job* next)
+{
+	first->priority = parent->priority;
+	next->priority = parent->priority;
+	++parent->unfinished_jobs;
+	next->parent = parent;
+	SubmitJobAfter(next, first);
+	SubmitJob(first);
+}
+
+//Same, for a pass with nothing to wait on.
+inline void SubmitPass(Job* parent, Job* pass)
+{
+	pass->priority = parent->priority;
+	++parent->unfinished_jobs;
+	pass->parent = parent;
+	SubmitJob(pass);
+}
+
+struct AlgorithmBlocks
+{
+	size_t count;
+	size_t block_size;
+	size_t num_blocks;
+
+	explicit AlgorithmBlocks(size_t element_count) :
+		count{ element_count },
+		block_size{ GetAlgorithmBlockSize(element_count) },
+		num_blocks{ (element_count + block_size - 1) / block_size }
+	{}
+
+	size_t Begin(size_t block) const { return block * block_size; }
+	size_t End(size_t block) const { return std::min(Begin(block) + block_size, count); }
+};
+
+/*
+	Reduces fn(0) ... fn(count - 1) with op, and writes the result to *result.
+	op must be associative, but doesn't need to be commutative - blocks are combined in order.
+	identity must be an identity for op (0 for +, 1 for *, etc).
+	e.g. ParallelReduce(n, 0.0f, [&](size_t i) { return x[i] * x[i]; }, std::plus<float>(), &sum_of_squares);
+*/
+template<typename T, typename Fn, typename Op>
+Job* ParallelReduce(size_t count, const T& identity, const Fn& fn, const Op& op, T* result)
+{
+	struct State
+	{
+		AlgorithmBlocks blocks;
+		T identity;
+		Fn fn;
+		Op op;
+		T* result;
+		T* partials;
+
+		T ReduceBlock(size_t b) const
+		{
+			T value = identity;
+			for (size_t i = blocks.Begin(b); i < blocks.End(b); i++) {
+				value = op(value, fn(i));
+			}
+			return value;
+		}
+	};
+
+	auto state = CreateScratchObject(State{ AlgorithmBlocks(count), identity, fn, op, result, nullptr });
+	if (state->blocks.num_blocks <= 1) {
+		return CreateJob([state](Job*) {
+			*state->result = (state->blocks.count > 0) ? state->ReduceBlock(0) : state->identity;
+		});
+	}
+
+	state->partials = AllocateScratchArray<T>(state->blocks.num_blocks);
+	return CreateJob([state](Job* root) {
+		Job* reduce_blocks = ParallelFor(state->blocks.num_blocks, 1, [state](size_t b) {
+			new(&state->partials[b]) T(state->ReduceBlock(b));
+		});
+		Job* combine = CreateJob([state](Job*) {
+			T value = state->partials[0];
+			for (size_t b = 1; b < state->blocks.num_blocks; b++) {
+				value = state->op(value, state->partials[b]);
+			}
+			*state->result = value;
+		});
+		SubmitPass(root, reduce_blocks, combine);
+	});
+}
+
+/*
+	output[i] = input[0] op input[1] op ... op input[i]. op must be associative.
+	input and output may be the same array.
+*/
+template<typename T, typename Op>
+Job* ParallelInclusiveScan(const T* input, T* output, size_t count, const Op& op)
+{
+	struct State
+	{
+		AlgorithmBlocks blocks;
+		const T* input;
+		T* output;
+		Op op;
+		T* block_totals;
+
+		//Reads every input before writing its output, so it's fine for input == output.
+		void ScanBlock(size_t b, const T* offset) const
+		{
+			size_t i = blocks.Begin(b);
+			T value = offset ? op(*offset, input[i]) : input[i];
+			output[i] = value;
+			for (i++; i < blocks.End(b); i++) {
+				value = op(value, input[i]);
+				output[i] = value;
+			}
+		}
+	};
+
+	auto state = CreateScratchObject(State{ AlgorithmBlocks(count), input, output, op, nullptr });
+	if (state->blocks.num_blocks <= 1) {
+		return CreateJob([state](Job*) {
+			if (state->blocks.count > 0) {
+				state->ScanBlock(0, nullptr);
+			}
+		});
+	}
+
+	//Sum each block, scan the block totals serially, then scan each block again starting from the total of the blocks before it.
+	state->block_totals = AllocateScratchArray<T>(state->blocks.num_blocks);
+	return CreateJob([state](Job* root) {
+		Job* sum_blocks = ParallelFor(state->blocks.num_blocks, 1, [state](size_t b) {
+			const size_t begin = state->blocks.Begin(b);
+			T value = state->input[begin];
+			for (size_t i = begin + 1; i < state->blocks.End(b); i++) {
+				value = state->op(value, state->input[i]);
+			}
+			new(&state->block_totals[b]) T(value);
+		});
+		Job* scan_totals = CreateJob([state](Job* j) {
+			for (size_t b = 1; b < state->blocks.num_blocks; b++) {
+				state->block_totals[b] = state->op(state->block_totals[b - 1], state->block_totals[b]);
+			}
+			SubmitPass(j, ParallelFor(state->blocks.num_blocks, 1, [state](size_t b) {
+				state->ScanBlock(b, (b > 0) ? &state->block_totals[b - 1] : nullptr);
+			}));
+		});
+		SubmitPass(root, sum_blocks, scan_totals);
+	});
+}
+
+//DON'T CALL THESE FUNCTIONS DIRECTLY! NOT PART OF THE PUBLIC INTERFACE!
+//Finds how many of the first k elements of merge(a, b) come from a. Ties go to a, so merging is stable.
+template<typename T, typename Compare>
+size_t MergePathSplit(const T* a, size_t a_count, const T* b, size_t b_count, size_t k, const Compare& less)
+{
+	size_t low = (k > b_count) ? k - b_count : 0;
+	size_t high = std::min(k, a_count);
+	while (low < high) {
+		const size_t i = low + (high - low) / 2;
+		const size_t j = k - i;
+		//a[i] belongs before b[j - 1], so more than i elements come from a.
+		if (!less(b[j - 1], a[i])) {
+			low = i + 1;
+		}
+		else {
+			high = i;
+		}
+	}
+	return low;
+}
+
+template<typename State>
+void MergeSortPass(Job* j, State* state, size_t run_length)
+{
+	using T = std::remove_pointer_t<decltype(state->data)>;
+	const auto& blocks = state->blocks;
+	if (run_length >= blocks.count) {
+		if (state->sorted != state->data) {
+			SubmitPass(j, ParallelFor(blocks.num_blocks, 1, [state](size_t b) {
+				std::copy(state->sorted + state->blocks.Begin(b), state->sorted + state->blocks.End(b), state->data + state->blocks.Begin(b));
+			}));
+		}
+		return;
+	}
+
+	//Merges pairs of runs from sorted into the other buffer. Every pair is cut into block-sized pieces
+	//(run_length is always a multiple of the block size), which are merged independently.
+	T* source = state->sorted;
+	T* destination = (source == state->data) ? state->scratch : state->data;
+	Job* merge = ParallelFor(blocks.num_blocks, 1, [state, source, destination, run_length](size_t piece) {
+		const auto& blocks = state->blocks;
+		const size_t pair_begin = blocks.Begin(piece) / (2 * run_length) * (2 * run_length);
+		const size_t middle = std::min(pair_begin + run_length, blocks.count);
+		const size_t pair_end = std::min(pair_begin + 2 * run_length, blocks.count);
+		const T* a = source + pair_begin;
+		const T* b = source + middle;
+		const size_t a_count = middle - pair_begin;
+		const size_t b_count = pair_end - middle;
+
+		const size_t begin = blocks.Begin(piece) - pair_begin;
+		const size_t end = blocks.End(piece) - pair_begin;
+		const size_t a_begin = MergePathSplit(a, a_count, b, b_count, begin, state->less);
+		const size_t a_end = MergePathSplit(a, a_count, b, b_count, end, state->less);
+		std::merge(a + a_begin, a + a_end, b + (begin - a_begin), b + (end - a_end), destination + pair_begin + begin, state->less);
+	});
+	Job* next = CreateJob([state, run_length](Job* job) {
+		MergeSortPass(job, state, run_length * 2);
+	});
+	state->sorted = destination;
+	SubmitPass(j, merge, next);
+}
+
+/*
+	Sorts data with less. Each block is sorted with std::sort, then the blocks are merged in rounds,
+	with each merge split into pieces so every round runs on all threads.
+	Not stable. Needs count elements of scratch, so T must be trivially copyable.
+*/
+template<typename T, typename Compare>
+Job* ParallelSort(T* data, size_t count, const Compare& less)
+{
+	static_assert(std::is_trivially_copyable<T>::value, "ParallelSort copies elements through scratch memory.");
+	struct State
+	{
+		AlgorithmBlocks blocks;
+		T* data;
+		T* scratch;
+		T* sorted; //Whichever of data/scratch currently holds the sorted runs.
+		Compare less;
+	};
+
+	auto state = CreateScratchObject(State{ AlgorithmBlocks(count), data, nullptr, data, less });
+	if (state->blocks.num_blocks <= 1) {
+		return CreateJob([state](Job*) {
+			std::sort(state->data, state->data + state->blocks.count, state->less);
+		});
+	}
+
+	state->scratch = AllocateScratchArray<T>(count);
+	return CreateJob([state](Job* root) {
+		Job* sort_blocks = ParallelFor(state->blocks.num_blocks, 1, [state](size_t b) {
+			std::sort(state->data + state->blocks.Begin(b), state->data + state->blocks.End(b), state->less);
+		});
+		Job* merge = CreateJob([state](Job* j) {
+			MergeSortPass(j, state, state->blocks.block_size);
+		});
+		SubmitPass(root, sort_blocks, merge);
+	});
+}
+
+template<typename T>
+Job* ParallelSort(T* data, size_t count)
+{
+	return ParallelSort(data, count, std::less<T>());
+}
+
+/*
+	Moves every element matching pred in front of those which don't, keeping their relative order,
+	and writes the number of matching elements to *num_matching.
+	Needs count elements of scratch, so T must be trivially copyable.
+*/
+template<typename T, typename Predicate>
+Job* ParallelPartition(T* data, size_t count, const Predicate& pred, size_t* num_matching)
+{
+	static_assert(std::is_trivially_copyable<T>::value, "ParallelPartition copies elements through scratch memory.");
+	struct State
+	{
+		AlgorithmBlocks blocks;
+		T* data;
+		Predicate pred;
+		size_t* num_matching;
+		T* scratch;
+		bool* matches; //pred is only evaluated once per element.
+		size_t* block_offsets; //Number of matching elements before each block.
+	};
+
+	auto state = CreateScratchObject(State{ AlgorithmBlocks(count), data, pred, num_matching, nullptr, nullptr, nullptr });
+	if (state->blocks.num_blocks <= 1) {
+		return CreateJob([state](Job*) {
+			auto middle = std::stable_partition(state->data, state->data + state->blocks.count, state->pred);
+			*state->num_matching = middle - state->data;
+		});
+	}
+
+	//Count the matches in each block, scan the counts, then each block knows where to put its elements.
+	state->scratch = AllocateScratchArray<T>(count);
+	state->matches = AllocateScratchArray<bool>(count);
+	state->block_offsets = AllocateScratchArray<size_t>(state->blocks.num_blocks + 1);
+	return CreateJob([state](Job* root) {
+		Job* count_blocks = ParallelFor(state->blocks.num_blocks, 1, [state](size_t b) {
+			size_t num_matches = 0;
+			for (size_t i = state->blocks.Begin(b); i < state->blocks.End(b); i++) {
+				state->matches[i] = state->pred(state->data[i]) ? true : false;
+				num_matches += state->matches[i];
+			}
+			state->block_offsets[b + 1] = num_matches;
+		});
+		Job* scatter = CreateJob([state](Job* j) {
+			const size_t num_blocks = state->blocks.num_blocks;
+			state->block_offsets[0] = 0;
+			for (size_t b = 1; b <= num_blocks; b++) {
+				state->block_offsets[b] += state->block_offsets[b - 1];
+			}
+			*state->num_matching = state->block_offsets[num_blocks];
+
+			Job* scatter_blocks = ParallelFor(num_blocks, 1, [state](size_t b) {
+				const size_t begin = state->blocks.Begin(b);
+				size_t matching = state->block_offsets[b];
+				size_t not_matching = *state->num_matching + (begin - state->block_offsets[b]);
+				for (size_t i = begin; i < state->blocks.End(b); i++) {
+					state->scratch[state->matches[i] ? matching++ : not_matching++] = state->data[i];
+				}
+			});
+			Job* copy_back = ParallelFor(num_blocks, 1, [state](size_t b) {
+				std::copy(state->scratch + state->blocks.Begin(b), state->scratch + state->blocks.End(b), state->data + state->blocks.Begin(b));
+			});
+			SubmitPass(j, scatter_blocks, copy_back);
+		});
+		SubmitPass(root, count_blocks, scatter);
+	});
+}
+
+}
+}
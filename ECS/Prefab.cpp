@@ -0,0 +1,34 @@
+#include "Prefab.h"
+
+namespace rkg
+{
+namespace ecs
+{
+
+Prefab::~Prefab()
+{
+	for (auto& component : components_) {
+		allocator_.Deallocate(component.prototype);
+	}
+}
+
+void Prefab::Spawn(Scene& scene, size_t count, std::vector<EntityID>* ids)
+{
+	if (count == 0) {
+		return;
+	}
+	std::vector<EntityID>& out = ids ? *ids : scratch_ids_;
+	if (!ids) {
+		scratch_ids_.clear();
+	}
+	const size_t first = out.size();
+	out.resize(first + count);
+	scene.CreateEntities(count, &out[first]);
+
+	for (auto& component : components_) {
+		component.spawn(component.container, component.prototype.ptr, &out[first], count);
+	}
+}
+
+} //end namespace ecs;
+} //end namespace rkg;
@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+#include <cstring>
+#include <type_traits>
+
+#include "ECS/Entities.h"
+#include "Utilities/Allocators.h"
+
+namespace rkg
+{
+namespace ecs
+{
+
+/*
+	A template for spawning lots of identical entities at once - e.g. loading a level, or a burst of particles.
+	Give it a prototype value for each component the entities should have:
+		Prefab rock;
+		rock.Add(transforms, Transform{ ... });
+		rock.Add(meshes, rock_mesh);
+		rock.Spawn(scene, 50000, &ids);
+	Spawn reserves all the entities in one go, then for each container appends copies of the prototype in one
+	pass and registers them in its index, rather than making a Create call per entity per component. Anything which
+	differs between instances can be set afterwards, through the returned ids.
+	Prototypes are copied as bytes, so components need to be trivially copyable.
+*/
+class Prefab
+{
+public:
+	Prefab() = default;
+	~Prefab();
+	Prefab(const Prefab&) = delete;
+	Prefab& operator=(const Prefab&) = delete;
+
+	//Every entity spawned from the prefab gets a copy of prototype in container. The container has to outlive the prefab.
+	template<typename Container>
+	void Add(Container& container, const typename Container::ValueType& prototype);
+
+	//Makes count entities with all the prefab's components. If ids isn't null, their ids are appended to it.
+	void Spawn(Scene& scene, size_t count, std::vector<EntityID>* ids = nullptr);
+
+	inline size_t GetNumComponents() const { return components_.size(); }
+
+private:
+	using SpawnFn = void(*)(void* container, const void* prototype, const EntityID* ids, size_t count);
+
+	struct PrefabComponent
+	{
+		void* container;
+		MemoryBlock prototype;
+		SpawnFn spawn;
+	};
+
+	std::vector<PrefabComponent> components_;
+	std::vector<EntityID> scratch_ids_; //Kept between spawns, for when the caller doesn't want the ids.
+	Mallocator allocator_;
+};
+
+template<typename Container>
+void Prefab::Add(Container& container, const typename Container::ValueType& prototype)
+{
+	using T = typename Container::ValueType;
+	static_assert(std::is_trivially_copyable<T>::value, "Prefab components are copied as bytes, so need to be trivially copyable.");
+	for (auto& component : components_) {
+		Expects(component.container != &container && "Prefab already has a component for this container.");
+	}
+
+	PrefabComponent component;
+	component.container = &container;
+	component.prototype = allocator_.Allocate(sizeof(T));
+	memcpy(component.prototype.ptr, &prototype, sizeof(T));
+	component.spawn = [](void* c, const void* p, const EntityID* ids, size_t count) {
+		static_cast<Container*>(c)->CreateMany(ids, count, *static_cast<const T*>(p));
+	};
+	components_.push_back(component);
+}
+
+} //end namespace ecs;
+} //end namespace rkg;
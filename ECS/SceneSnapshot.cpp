@@ -0,0 +1,209 @@
+#include "SceneSnapshot.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "Utilities/Filesystem.h"
+
+namespace rkg
+{
+namespace ecs
+{
+
+namespace {
+	struct SnapshotHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t num_sections;
+		uint32_t reserved;
+	};
+
+	//Where an array is in the file. Offsets are from the start of the file, and 16 byte aligned.
+	struct SectionHeader
+	{
+		uint64_t name_hash;
+		uint64_t offset;
+		uint64_t size;
+		uint32_t element_size;
+		uint32_t count;
+	};
+
+	constexpr size_t SECTION_ALIGNMENT{ 16 };
+	constexpr uint64_t ENTITIES_SECTION{ Hash64("Scene.Entities") };
+	constexpr uint64_t GENERATIONS_SECTION{ Hash64("Scene.Generations") };
+
+	//A section to write, from either an array or a registered container.
+	struct SectionSource
+	{
+		SectionHeader header;
+		const void* data;
+		bool(*write)(const void* container, FILE* f);
+		const void* container;
+	};
+
+	inline uint64_t AlignOffset(uint64_t offset)
+	{
+		return (offset + SECTION_ALIGNMENT - 1) & ~uint64_t(SECTION_ALIGNMENT - 1);
+	}
+
+	const SectionHeader* FindSection(const SectionHeader* sections, uint32_t count, uint64_t name_hash)
+	{
+		for (uint32_t i = 0; i < count; i++) {
+			if (sections[i].name_hash == name_hash) {
+				return &sections[i];
+			}
+		}
+		return nullptr;
+	}
+}
+
+constexpr uint32_t SceneSnapshot::MAGIC;
+constexpr uint32_t SceneSnapshot::VERSION;
+
+SceneSnapshot::SceneSnapshot(Scene* scene)
+	: scene_{ scene }
+{
+	Expects(scene);
+}
+
+bool SceneSnapshot::Save(const char* path) const
+{
+	const uint32_t num_indices = scene_->GetIndexCapacity();
+	std::vector<uint32_t> generations(num_indices);
+	for (uint32_t i = 0; i < num_indices; i++) {
+		generations[i] = scene_->GetGeneration(i);
+	}
+
+	std::vector<SectionSource> sources;
+	sources.reserve(sections_.size() + 2);
+	auto add_source = [&sources](uint64_t name_hash, uint32_t element_size, size_t count, const void* data) -> SectionSource& {
+		SectionSource source{};
+		source.header.name_hash = name_hash;
+		source.header.offset = 0;
+		source.header.size = uint64_t(element_size) * count;
+		source.header.element_size = element_size;
+		source.header.count = static_cast<uint32_t>(count);
+		source.data = data;
+		sources.push_back(source);
+		return sources.back();
+	};
+	add_source(ENTITIES_SECTION, sizeof(Entity), scene_->GetNumEntities(), scene_->Data());
+	add_source(GENERATIONS_SECTION, sizeof(uint32_t), num_indices, generations.data());
+	for (auto& section : sections_) {
+		auto& source = add_source(section.name_hash, section.element_size, section.count(section.container), nullptr);
+		source.write = section.write;
+		source.container = section.container;
+	}
+
+	uint64_t offset = AlignOffset(sizeof(SnapshotHeader) + sizeof(SectionHeader) * sources.size());
+	for (auto& source : sources) {
+		source.header.offset = offset;
+		offset = AlignOffset(offset + source.header.size);
+	}
+
+	FILE* f;
+	fopen_s(&f, path, "wb");
+	if (!f) {
+		return false;
+	}
+
+	SnapshotHeader header{ MAGIC, VERSION, static_cast<uint32_t>(sources.size()), 0 };
+	bool success = fwrite(&header, sizeof(header), 1, f) == 1;
+	for (auto& source : sources) {
+		success = success && fwrite(&source.header, sizeof(SectionHeader), 1, f) == 1;
+	}
+	uint64_t written = sizeof(SnapshotHeader) + sizeof(SectionHeader) * sources.size();
+	const char padding[SECTION_ALIGNMENT] = {};
+	for (auto& source : sources) {
+		const size_t pad = static_cast<size_t>(source.header.offset - written);
+		success = success && fwrite(padding, 1, pad, f) == pad;
+		const size_t size = static_cast<size_t>(source.header.size);
+		if (source.write) {
+			success = success && source.write(source.container, f);
+		}
+		else {
+			success = success && fwrite(source.data, 1, size, f) == size;
+		}
+		written = source.header.offset + source.header.size;
+	}
+	fclose(f);
+	return success;
+}
+
+bool SceneSnapshot::Load(const char* path)
+{
+	MappedFile file = MapFile(path);
+	if (!file.data) {
+		return false;
+	}
+	const char* base = static_cast<const char*>(file.data);
+
+	//Check everything before touching the scene, so a bad file leaves it as it was.
+	auto fail = [&file]() {
+		UnmapFile(file);
+		return false;
+	};
+	if (file.size < sizeof(SnapshotHeader)) {
+		return fail();
+	}
+	SnapshotHeader header;
+	memcpy(&header, base, sizeof(header));
+	if (header.magic != MAGIC || header.version != VERSION
+		|| (file.size - sizeof(SnapshotHeader)) / sizeof(SectionHeader) < header.num_sections) {
+		return fail();
+	}
+
+	//The mapping is page aligned, and so are the headers after the snapshot header.
+	const auto sections = reinterpret_cast<const SectionHeader*>(base + sizeof(SnapshotHeader));
+	for (uint32_t i = 0; i < header.num_sections; i++) {
+		const auto& section = sections[i];
+		if (section.offset % SECTION_ALIGNMENT != 0 || section.offset > file.size || section.size > file.size - section.offset
+			|| uint64_t(section.element_size) * section.count != section.size) {
+			return fail();
+		}
+	}
+
+	const auto entities = FindSection(sections, header.num_sections, ENTITIES_SECTION);
+	const auto generations = FindSection(sections, header.num_sections, GENERATIONS_SECTION);
+	if (!entities || entities->element_size != sizeof(Entity) || !generations || generations->element_size != sizeof(uint32_t)) {
+		return fail();
+	}
+	for (auto& section : sections_) {
+		const auto found = FindSection(sections, header.num_sections, section.name_hash);
+		if (found && found->element_size != section.element_size) {
+			return fail();
+		}
+	}
+
+	//Restore asserts on ids which don't match the generations, so check them here. Each index can only be used once.
+	const auto entity_data = reinterpret_cast<const Entity*>(base + entities->offset);
+	const auto generation_data = reinterpret_cast<const uint32_t*>(base + generations->offset);
+	std::vector<uint8_t> used(generations->count, 0);
+	for (uint32_t i = 0; i < entities->count; i++) {
+		const EntityID id = entity_data[i].id;
+		const uint32_t index = GetEntityIndex(id);
+		if (index >= generations->count || generation_data[index] != GetEntityGeneration(id) || used[index]) {
+			return fail();
+		}
+		used[index] = 1;
+	}
+
+	//Arrays are bulk copied out of the mapping, rather than built up an element at a time.
+	scene_->Restore(entity_data, entities->count, generation_data, generations->count);
+	for (auto& section : sections_) {
+		const auto found = FindSection(sections, header.num_sections, section.name_hash);
+		if (found) {
+			section.assign(section.container, base + found->offset, found->count);
+		}
+		else {
+			section.assign(section.container, nullptr, 0);
+		}
+	}
+
+	UnmapFile(file);
+	return true;
+}
+
+} //end namespace ecs;
+} //end namespace rkg;
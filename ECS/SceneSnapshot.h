@@ -0,0 +1,91 @@
+#pragma once
+#include <vector>
+#include <cstdio>
+#include <type_traits>
+
+#include "ECS/Entities.h"
+
+namespace rkg
+{
+namespace ecs
+{
+
+/*
+	Binary snapshots of a Scene and a set of ComponentContainers, for fast loading.
+	The file is a header, a table of sections, and then each array exactly as it is in memory, so loading
+	maps the file and does one copy per array rather than constructing entities one at a time.
+	Only trivially copyable components can be snapshotted, and snapshots are only readable by builds with
+	the same component layouts - keep authoring data in json, and build snapshots from it.
+
+	Containers are matched up by name, so names need to stay the same between saving and loading:
+		SceneSnapshot snapshot(&scene);
+		snapshot.Register("Mesh", &meshes);
+		snapshot.Register("Light", &lights);
+		snapshot.Save("level.snapshot");
+		...
+		snapshot.Load("level.snapshot");
+*/
+class SceneSnapshot
+{
+public:
+	static constexpr uint32_t MAGIC{ 0x534b4752 }; //"RGKS"
+	static constexpr uint32_t VERSION{ 1 };
+
+	explicit SceneSnapshot(Scene* scene);
+
+	template<typename Container>
+	void Register(const char* name, Container* container);
+
+	bool Save(const char* path) const;
+	//Replaces the scene and every registered container with the snapshot's contents. Containers with no data in the
+	//snapshot are cleared. Returns false, leaving everything untouched, if the file can't be read or doesn't match.
+	bool Load(const char* path);
+
+private:
+	struct Section
+	{
+		uint64_t name_hash;
+		uint32_t element_size;
+		void* container;
+		size_t(*count)(const void* container);
+		bool(*write)(const void* container, FILE* f);
+		void(*assign)(void* container, const void* data, size_t count);
+	};
+
+	Scene* scene_;
+	std::vector<Section> sections_;
+};
+
+template<typename Container>
+void SceneSnapshot::Register(const char* name, Container* container)
+{
+	using T = typename Container::ValueType;
+	static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable components can be snapshotted.");
+
+	const uint64_t name_hash = Hash64(name);
+	for (auto& section : sections_) {
+		Expects(section.name_hash != name_hash && "Snapshot section names must be unique.");
+	}
+
+	Section section;
+	section.name_hash = name_hash;
+	section.element_size = sizeof(T);
+	section.container = container;
+	section.count = [](const void* c) {
+		return static_cast<const Container*>(c)->Size();
+	};
+	section.write = [](const void* c, FILE* f) {
+		bool success = true;
+		static_cast<const Container*>(c)->ForEachRange([&success, f](const T* data, size_t count) {
+			success = success && fwrite(data, sizeof(T), count, f) == count;
+		});
+		return success;
+	};
+	section.assign = [](void* c, const void* data, size_t count) {
+		static_cast<Container*>(c)->Assign(static_cast<const T*>(data), count);
+	};
+	sections_.push_back(section);
+}
+
+} //end namespace ecs;
+} //end namespace rkg;
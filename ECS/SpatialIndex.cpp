@@ -0,0 +1,325 @@
+#include "SpatialIndex.h"
+
+#include <cmath>
+
+#include "ECS/JobSystem.h"
+#include "ECS/Transforms.h"
+
+namespace rkg
+{
+namespace ecs
+{
+
+namespace {
+	inline uint32_t HashCell(int32_t x, int32_t y, int32_t z)
+	{
+		return uint32_t(x) * 73856093u ^ uint32_t(y) * 19349663u ^ uint32_t(z) * 83492791u;
+	}
+
+	//Keeps far away points from overflowing the cell coordinates.
+	constexpr float MAX_CELL_COORDINATE{ float(1 << 30) };
+}
+
+constexpr uint32_t SpatialIndex::NO_ENTRY;
+
+SpatialIndex::SpatialIndex(float cell_size)
+	: cell_size_{ cell_size }, inverse_cell_size_{ 1.0f / cell_size }
+{
+	Expects(cell_size > 0.0f);
+}
+
+uint32_t SpatialIndex::Find(EntityID id) const
+{
+	uint32_t index = GetEntityIndex(id);
+	if (index >= lookup_.size()) {
+		return NO_ENTRY;
+	}
+	uint32_t i = lookup_[index];
+	if (i == NO_ENTRY || entries_[i].id != id) {
+		return NO_ENTRY;
+	}
+	return i;
+}
+
+bool SpatialIndex::Contains(EntityID id) const
+{
+	return Find(id) != NO_ENTRY;
+}
+
+void SpatialIndex::CellCoordinates(const Vec3& point, int32_t coordinates[3]) const
+{
+	for (int axis = 0; axis < 3; axis++) {
+		const float c = std::floor((&point.x)[axis] * inverse_cell_size_);
+		coordinates[axis] = static_cast<int32_t>(Clamp(c, -MAX_CELL_COORDINATE, MAX_CELL_COORDINATE));
+	}
+}
+
+uint32_t SpatialIndex::FindCell(int32_t x, int32_t y, int32_t z) const
+{
+	for (auto i = cell_index_.First(HashCell(x, y, z)); i != HashIndex::INVALID_INDEX; i = cell_index_.Next(i)) {
+		const auto& cell = cells_[i];
+		if (cell.x == x && cell.y == y && cell.z == z) {
+			return i;
+		}
+	}
+	return NO_ENTRY;
+}
+
+uint32_t SpatialIndex::FindOrAddCell(int32_t x, int32_t y, int32_t z)
+{
+	uint32_t i = FindCell(x, y, z);
+	if (i != NO_ENTRY) {
+		return i;
+	}
+	i = static_cast<uint32_t>(cells_.size());
+	cells_.emplace_back();
+	auto& cell = cells_.back();
+	cell.x = x;
+	cell.y = y;
+	cell.z = z;
+	cell.bounds_dirty = false;
+	cell_index_.Add(HashCell(x, y, z), i);
+	return i;
+}
+
+void SpatialIndex::Place(uint32_t entry, const AABB& world)
+{
+	int32_t c[3];
+	CellCoordinates(world.Center(), c);
+	auto& e = entries_[entry];
+	e.cell = FindOrAddCell(c[0], c[1], c[2]);
+	auto& cell = cells_[e.cell];
+	e.slot = static_cast<uint32_t>(cell.ids.size());
+	cell.bounds = cell.ids.empty() ? world : Union(cell.bounds, world);
+	cell.ids.push_back(e.id);
+	cell.world.push_back(world);
+	cell.entries.push_back(entry);
+	GrowReach(world);
+}
+
+void SpatialIndex::GrowReach(const AABB& world)
+{
+	const Vec3 extents = world.Extents();
+	const float reach = std::ceil(std::max(extents.x, std::max(extents.y, extents.z)) * inverse_cell_size_);
+	max_reach_ = std::max(max_reach_, static_cast<int32_t>(std::min(reach, MAX_CELL_COORDINATE)));
+}
+
+void SpatialIndex::RemoveFromCell(uint32_t entry)
+{
+	auto& e = entries_[entry];
+	auto& cell = cells_[e.cell];
+	const uint32_t last = static_cast<uint32_t>(cell.ids.size() - 1);
+	if (e.slot != last) {
+		cell.ids[e.slot] = cell.ids[last];
+		cell.world[e.slot] = cell.world[last];
+		cell.entries[e.slot] = cell.entries[last];
+		entries_[cell.entries[e.slot]].slot = e.slot;
+	}
+	cell.ids.pop_back();
+	cell.world.pop_back();
+	cell.entries.pop_back();
+	cell.bounds_dirty = !cell.ids.empty();
+}
+
+void SpatialIndex::SetWorldBounds(uint32_t entry, const AABB& world)
+{
+	auto& e = entries_[entry];
+	int32_t c[3];
+	CellCoordinates(world.Center(), c);
+	auto& cell = cells_[e.cell];
+	if (cell.x == c[0] && cell.y == c[1] && cell.z == c[2]) {
+		cell.world[e.slot] = world;
+		cell.bounds = Union(cell.bounds, world);
+		cell.bounds_dirty = true;
+		GrowReach(world);
+		return;
+	}
+	RemoveFromCell(entry);
+	Place(entry, world);
+}
+
+void SpatialIndex::TidyCell(Cell& cell)
+{
+	if (!cell.bounds_dirty) {
+		return;
+	}
+	if (!cell.world.empty()) {
+		cell.bounds = cell.world[0];
+		for (const auto& bounds : cell.world) {
+			cell.bounds = Union(cell.bounds, bounds);
+		}
+	}
+	cell.bounds_dirty = false;
+}
+
+void SpatialIndex::Add(EntityID id, const AABB& local_bounds, const Mat4& world)
+{
+	Expects(Find(id) == NO_ENTRY && "Entity is already in the spatial index.");
+	uint32_t index = GetEntityIndex(id);
+	if (index >= lookup_.size()) {
+		lookup_.resize(index + 1, NO_ENTRY);
+	}
+	const uint32_t entry = static_cast<uint32_t>(entries_.size());
+	lookup_[index] = entry;
+	entries_.push_back(Entry{ id, local_bounds, world, NO_ENTRY, NO_ENTRY });
+	Place(entry, TransformAABB(world, local_bounds));
+}
+
+void SpatialIndex::Remove(EntityID id)
+{
+	const uint32_t entry = Find(id);
+	if (entry == NO_ENTRY) {
+		return;
+	}
+	RemoveFromCell(entry);
+	lookup_[GetEntityIndex(id)] = NO_ENTRY;
+
+	//Swap the last entry into the gap.
+	const uint32_t last = static_cast<uint32_t>(entries_.size() - 1);
+	if (entry != last) {
+		entries_[entry] = entries_[last];
+		const auto& moved = entries_[entry];
+		lookup_[GetEntityIndex(moved.id)] = entry;
+		cells_[moved.cell].entries[moved.slot] = entry;
+	}
+	entries_.pop_back();
+}
+
+void SpatialIndex::SetLocalBounds(EntityID id, const AABB& local_bounds)
+{
+	const uint32_t entry = Find(id);
+	Expects(entry != NO_ENTRY);
+	auto& e = entries_[entry];
+	e.local = local_bounds;
+	SetWorldBounds(entry, TransformAABB(e.world, local_bounds));
+}
+
+void SpatialIndex::SetTransform(EntityID id, const Mat4& world)
+{
+	const uint32_t entry = Find(id);
+	Expects(entry != NO_ENTRY);
+	auto& e = entries_[entry];
+	e.world = world;
+	SetWorldBounds(entry, TransformAABB(world, e.local));
+}
+
+const AABB* SpatialIndex::GetBounds(EntityID id) const
+{
+	const uint32_t entry = Find(id);
+	if (entry == NO_ENTRY) {
+		return nullptr;
+	}
+	const auto& e = entries_[entry];
+	return &cells_[e.cell].world[e.slot];
+}
+
+void SpatialIndex::UpdateFromTransforms(const TransformHierarchy& transforms)
+{
+	const size_t count = transforms.Size();
+	const EntityID* ids = transforms.GetEntities();
+	const Mat4* worlds = transforms.GetWorldMatrices();
+	for (size_t i = 0; i < count; i++) {
+		if (!transforms.WasUpdated(i)) {
+			continue;
+		}
+		const uint32_t entry = Find(ids[i]);
+		if (entry != NO_ENTRY) {
+			auto& e = entries_[entry];
+			e.world = worlds[i];
+			SetWorldBounds(entry, TransformAABB(e.world, e.local));
+		}
+	}
+	for (auto& cell : cells_) {
+		TidyCell(cell);
+	}
+}
+
+void SpatialIndex::Rebuild(const TransformHierarchy* transforms, float cell_size)
+{
+	if (cell_size > 0.0f) {
+		cell_size_ = cell_size;
+		inverse_cell_size_ = 1.0f / cell_size;
+	}
+
+	//Work out everything's bounds and cell in parallel, sort them into cells on this thread, then fill the cells in parallel.
+	const size_t count = entries_.size();
+	std::vector<AABB> world(count);
+	std::vector<int32_t> coordinates(count * 3);
+	auto bounds_job = ParallelFor(count, [this, transforms, &world, &coordinates](size_t i) {
+		auto& e = entries_[i];
+		const Mat4* matrix = transforms ? transforms->GetWorld(e.id) : nullptr;
+		if (matrix) {
+			e.world = *matrix;
+		}
+		world[i] = TransformAABB(e.world, e.local);
+		CellCoordinates(world[i].Center(), &coordinates[3 * i]);
+	});
+	SubmitJob(bounds_job);
+	Wait(bounds_job);
+
+	cells_.clear();
+	cell_index_.Clear();
+	max_reach_ = 0;
+	for (uint32_t i = 0; i < count; i++) {
+		entries_[i].cell = FindOrAddCell(coordinates[3 * i], coordinates[3 * i + 1], coordinates[3 * i + 2]);
+		entries_[i].slot = static_cast<uint32_t>(cells_[entries_[i].cell].entries.size());
+		cells_[entries_[i].cell].entries.push_back(i);
+	}
+
+	auto fill_job = ParallelFor(cells_.size(), [this, &world](size_t c) {
+		auto& cell = cells_[c];
+		const size_t size = cell.entries.size();
+		cell.ids.resize(size);
+		cell.world.resize(size);
+		cell.bounds = world[cell.entries[0]];
+		for (size_t i = 0; i < size; i++) {
+			const uint32_t entry = cell.entries[i];
+			cell.ids[i] = entries_[entry].id;
+			cell.world[i] = world[entry];
+			cell.bounds = Union(cell.bounds, world[entry]);
+		}
+	});
+	SubmitJob(fill_job);
+	Wait(fill_job);
+	for (const auto& bounds : world) {
+		GrowReach(bounds);
+	}
+}
+
+EntityID SpatialIndex::Raycast(const Ray& ray, float max_distance, float* distance) const
+{
+	EntityID closest = INVALID_ENTITY;
+	float closest_distance = max_distance;
+	//Shortening the ray as hits are found skips cells behind the closest hit so far.
+	for (const auto& cell : cells_) {
+		if (cell.ids.empty() || Intersect(ray, cell.bounds, closest_distance) < 0.0f) {
+			continue;
+		}
+		const size_t count = cell.ids.size();
+		for (size_t i = 0; i < count; i++) {
+			const float t = Intersect(ray, cell.world[i], closest_distance);
+			if (t >= 0.0f && (closest == INVALID_ENTITY || t < closest_distance)) {
+				closest = cell.ids[i];
+				closest_distance = t;
+			}
+		}
+	}
+	if (distance && closest != INVALID_ENTITY) {
+		*distance = closest_distance;
+	}
+	return closest;
+}
+
+void SpatialIndex::Clear()
+{
+	for (const auto& e : entries_) {
+		lookup_[GetEntityIndex(e.id)] = NO_ENTRY;
+	}
+	entries_.clear();
+	cells_.clear();
+	cell_index_.Clear();
+	max_reach_ = 0;
+}
+
+} //end namespace ecs;
+} //end namespace rkg;
@@ -0,0 +1,198 @@
+#pragma once
+#include <vector>
+
+#include "ECS/Entities.h"
+#include "Utilities/Geometry.h"
+#include "Utilities/HashIndex.h"
+
+namespace rkg
+{
+namespace ecs
+{
+
+class TransformHierarchy;
+
+/*
+	Finds entities by where they are, without scanning all of them - for culling, picking and proximity queries.
+	A loose uniform grid: each entity is put in the one cell its bounds' center falls in, and each cell keeps the
+	union of its entities' bounds, so an entity can stick out of its cell without being stored more than once.
+	Queries test cell bounds first, then the entities of the cells which pass. Small box and sphere queries only
+	look at the cells near them.
+	Only occupied cells use memory, so the grid is unbounded. Pick a cell size around the size of a typical entity,
+	or a bit bigger.
+
+	Entities have bounds in their own space and a world transform. Keep transforms up to date with
+	UpdateFromTransforms after TransformHierarchy::UpdateWorldTransforms - it only touches entities which moved.
+
+	Queries can run concurrently with each other (e.g. from jobs), but not with anything which changes the index.
+*/
+class SpatialIndex
+{
+public:
+	explicit SpatialIndex(float cell_size = 8.0f);
+
+	void Add(EntityID id, const AABB& local_bounds, const Mat4& world = Mat4::Identity);
+	void Remove(EntityID id);
+	bool Contains(EntityID id) const;
+	void SetLocalBounds(EntityID id, const AABB& local_bounds);
+	void SetTransform(EntityID id, const Mat4& world);
+	//World space bounds, as of the last change.
+	const AABB* GetBounds(EntityID id) const;
+
+	//Picks up the world matrices which changed in the last TransformHierarchy::UpdateWorldTransforms.
+	//Also shrinks the bounds of cells which things were taken out of, which queries otherwise treat conservatively.
+	void UpdateFromTransforms(const TransformHierarchy& transforms);
+
+	//Recomputes every entity's world bounds (taking transforms from the hierarchy, if given) and re-bins all of them,
+	//optionally with a new cell size. Faster than updating entities one at a time when most of them moved.
+	//Runs through the job system, so call it from a thread in the pool.
+	void Rebuild(const TransformHierarchy* transforms = nullptr, float cell_size = 0.0f);
+
+	//Each of these calls fn(EntityID) for every entity whose world bounds overlap the shape.
+	template<typename Fn>
+	void QueryAABB(const AABB& box, Fn&& fn) const;
+	template<typename Fn>
+	void QuerySphere(const Sphere& sphere, Fn&& fn) const;
+	//Conservative, like Overlaps(Frustum, AABB) - things just outside the corners can get through.
+	template<typename Fn>
+	void QueryFrustum(const Frustum& frustum, Fn&& fn) const;
+	//Calls fn(EntityID, float distance) for every entity whose bounds the ray hits within max_distance, in no particular order.
+	template<typename Fn>
+	void QueryRay(const Ray& ray, float max_distance, Fn&& fn) const;
+	//Closest entity whose bounds the ray hits, or INVALID_ENTITY. distance is set if it isn't null.
+	EntityID Raycast(const Ray& ray, float max_distance = std::numeric_limits<float>::max(), float* distance = nullptr) const;
+
+	inline size_t Size() const { return entries_.size(); }
+	inline float GetCellSize() const { return cell_size_; }
+	void Clear();
+
+private:
+	static constexpr uint32_t NO_ENTRY{ UINT32_MAX };
+
+	struct Entry
+	{
+		EntityID id;
+		AABB local;
+		Mat4 world;
+		uint32_t cell;
+		uint32_t slot; //Position in the cell's arrays.
+	};
+
+	//Entities in a cell are SoA, so queries only read ids and bounds.
+	struct Cell
+	{
+		int32_t x, y, z;
+		AABB bounds; //Union of the bounds of everything in the cell. Only grows until the cell is tidied.
+		bool bounds_dirty; //Something was removed, so bounds could be shrunk.
+		std::vector<EntityID> ids;
+		std::vector<AABB> world;
+		std::vector<uint32_t> entries;
+	};
+
+	float cell_size_;
+	float inverse_cell_size_;
+	std::vector<Entry> entries_;
+	std::vector<uint32_t> lookup_; //Entry position, indexed by entity index.
+	std::vector<Cell> cells_; //Cells are never removed, only emptied, so cell positions stay valid.
+	HashIndex cell_index_;
+	int32_t max_reach_{ 0 }; //Furthest any entity sticks out of its cell, in cells.
+
+	uint32_t Find(EntityID id) const;
+	uint32_t FindCell(int32_t x, int32_t y, int32_t z) const;
+	uint32_t FindOrAddCell(int32_t x, int32_t y, int32_t z);
+	void CellCoordinates(const Vec3& point, int32_t coordinates[3]) const;
+	void Place(uint32_t entry, const AABB& world);
+	//Keeps max_reach_ covering an entity with these bounds, wherever it's stored.
+	void GrowReach(const AABB& world);
+	void RemoveFromCell(uint32_t entry);
+	void SetWorldBounds(uint32_t entry, const AABB& world);
+	void TidyCell(Cell& cell);
+
+	template<typename Test, typename Fn>
+	void Query(const AABB* region, Test&& test, Fn&& fn) const;
+};
+
+//Tests every occupied cell, or if region is given and small, only the cells which could hold things overlapping it.
+template<typename Test, typename Fn>
+void SpatialIndex::Query(const AABB* region, Test&& test, Fn&& fn) const
+{
+	auto visit = [&test, &fn](const Cell& cell) {
+		if (cell.ids.empty() || !test(cell.bounds)) {
+			return;
+		}
+		const size_t count = cell.ids.size();
+		for (size_t i = 0; i < count; i++) {
+			if (test(cell.world[i])) {
+				fn(cell.ids[i]);
+			}
+		}
+	};
+
+	if (region) {
+		int32_t lo[3], hi[3];
+		CellCoordinates(region->min, lo);
+		CellCoordinates(region->max, hi);
+		double num_cells = 1.0;
+		for (int axis = 0; axis < 3; axis++) {
+			lo[axis] -= max_reach_;
+			hi[axis] += max_reach_;
+			num_cells *= double(hi[axis]) - double(lo[axis]) + 1.0;
+		}
+		if (num_cells < double(cells_.size())) {
+			for (int32_t z = lo[2]; z <= hi[2]; z++) {
+				for (int32_t y = lo[1]; y <= hi[1]; y++) {
+					for (int32_t x = lo[0]; x <= hi[0]; x++) {
+						const uint32_t cell = FindCell(x, y, z);
+						if (cell != NO_ENTRY) {
+							visit(cells_[cell]);
+						}
+					}
+				}
+			}
+			return;
+		}
+	}
+	for (const auto& cell : cells_) {
+		visit(cell);
+	}
+}
+
+template<typename Fn>
+void SpatialIndex::QueryAABB(const AABB& box, Fn&& fn) const
+{
+	Query(&box, [&box](const AABB& bounds) { return Overlaps(box, bounds); }, fn);
+}
+
+template<typename Fn>
+void SpatialIndex::QuerySphere(const Sphere& sphere, Fn&& fn) const
+{
+	const Vec3 radius(sphere.radius, sphere.radius, sphere.radius);
+	const AABB region{ sphere.center - radius, sphere.center + radius };
+	Query(&region, [&sphere](const AABB& bounds) { return Overlaps(sphere, bounds); }, fn);
+}
+
+template<typename Fn>
+void SpatialIndex::QueryFrustum(const Frustum& frustum, Fn&& fn) const
+{
+	Query(nullptr, [&frustum](const AABB& bounds) { return Overlaps(frustum, bounds); }, fn);
+}
+
+template<typename Fn>
+void SpatialIndex::QueryRay(const Ray& ray, float max_distance, Fn&& fn) const
+{
+	for (const auto& cell : cells_) {
+		if (cell.ids.empty() || Intersect(ray, cell.bounds, max_distance) < 0.0f) {
+			continue;
+		}
+		const size_t count = cell.ids.size();
+		for (size_t i = 0; i < count; i++) {
+			const float t = Intersect(ray, cell.world[i], max_distance);
+			if (t >= 0.0f) {
+				fn(cell.ids[i], t);
+			}
+		}
+	}
+}
+
+} //end namespace ecs;
+} //end namespace rkg;
@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <thread>
+#include <algorithm>
 
 #define NOMINMAX
 #include "External/GLFW/glfw3.h"
@@ -14,6 +15,7 @@
 #include "Utilities/Utilities.h"
 #include "Utilities/Input.h"
 #include "ECS/JobSystem.h"
+#include "ECS/Events.h"
 
 namespace rkg {
 namespace ecs {
@@ -22,6 +24,54 @@ namespace ecs {
 		std::vector<System*> systems;
 		bool running;
 
+		//For each system, the earlier systems it conflicts with and has to run after.
+		//Access is declared up front, so this only needs rebuilding when systems are added.
+		std::vector<std::vector<int>> system_dependencies;
+		bool dependencies_dirty{ true };
+
+		void BuildSystemDependencies()
+		{
+			system_dependencies.clear();
+			system_dependencies.resize(systems.size());
+			for (size_t i = 0; i < systems.size(); i++) {
+				const auto& access = systems[i]->GetAccess();
+				for (size_t j = 0; j < i; j++) {
+					if (access.ConflictsWith(systems[j]->GetAccess())) {
+						system_dependencies[i].push_back(static_cast<int>(j));
+					}
+				}
+			}
+			dependencies_dirty = false;
+		}
+
+		//Runs fn(system) for every system as a graph of jobs, and waits for all of them to finish.
+		template<typename Fn>
+		void RunSystemPhase(Fn fn)
+		{
+			if (dependencies_dirty) {
+				BuildSystemDependencies();
+			}
+
+			std::vector<Job*> jobs(systems.size());
+			std::vector<Job*> dependencies;
+			JobCounter counter;
+			for (size_t i = 0; i < systems.size(); i++) {
+				System* system = systems[i];
+				jobs[i] = CreateJob([system, fn](Job*) { fn(system); });
+				if (system->GetAccess().main_thread) {
+					jobs[i]->pinned_thread = JobThread::MAIN;
+				}
+				AttachCounter(jobs[i], &counter);
+
+				dependencies.clear();
+				for (int dependency : system_dependencies[i]) {
+					dependencies.push_back(jobs[dependency]);
+				}
+				SubmitJobAfter(jobs[i], dependencies.data(), static_cast<int>(dependencies.size()));
+			}
+			WaitForCounter(&counter);
+		}
+
 
 		void GLFWErrorCallback(int error, const char* description)
 		{
@@ -121,9 +171,28 @@ namespace ecs {
 		}
 	}
 
+	bool SystemAccess::ConflictsWith(const SystemAccess& other) const
+	{
+		if (!declared || !other.declared) {
+			return true;
+		}
+		auto overlaps = [](const std::vector<ComponentTypeID>& a, const std::vector<ComponentTypeID>& b) {
+			for (auto id : a) {
+				for (auto other_id : b) {
+					if (id == other_id) {
+						return true;
+					}
+				}
+			}
+			return false;
+		};
+		return overlaps(writes, other.writes) || overlaps(writes, other.reads) || overlaps(reads, other.writes);
+	}
+
 	void AddSystem(System* system)
 	{
 		systems.push_back(system);
+		dependencies_dirty = true;
 	}
 
 	void Run()
@@ -136,7 +205,8 @@ namespace ecs {
 		rkg::render::Initialize(window); //Spawn the render thread.
 		//TODO: Error callback
 		rkg::InitializeImgui(window);
-		ecs::InitializeWorkerThreads(std::thread::hardware_concurrency() - 2);
+		//Leave a core each for this thread and the render thread. Fibers stay off - systems assume a job doesn't change thread part way through.
+		ecs::InitializeWorkerThreads(std::max(static_cast<int>(std::thread::hardware_concurrency()) - 2, 0));
 
 		for (auto system : systems) {
 			system->Initialize();
@@ -149,6 +219,9 @@ namespace ecs {
 
 		while (!glfwWindowShouldClose(window) && running)
 		{
+			ecs::AdvanceChangeVersion();
+			//Events sent last frame become readable.
+			ecs::FlushEventChannels();
 			//Reset inputs before processing new ones.
 			for (int i = 0; i < 3; i++) {
 				rkg::Input::MouseButtonPressed[i] = false;
@@ -166,15 +239,15 @@ namespace ecs {
 			current_time = new_time;
 			accumulator += frame_time;
 			while (accumulator >= fixed_timestep) {
-				for (auto sys : systems) {
-					sys->FixedUpdate();
-				}
+				RunSystemPhase([](System* sys) { sys->FixedUpdate(); });
 				accumulator -= fixed_timestep;
 			}
 
-			for (auto sys : systems) {
-				sys->Update(frame_time);
-			}
+			RunSystemPhase([frame_time](System* sys) { sys->Update(frame_time); });
+			RunSystemPhase([](System* sys) { sys->LateUpdate(); });
+
+			//Anything pinned to this thread that nobody waited on.
+			ecs::RunPinnedJobs(ecs::JobThread::MAIN);
 
 			//Do render here... it should probably be a hardcoded system.
 			ImGui::Render();
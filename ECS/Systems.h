@@ -1,8 +1,30 @@
 #pragma once
+#include <vector>
+
+#include "ECS/Entities.h"
+
 namespace rkg
 {
 namespace ecs
 {
+
+//Which component types a system touches, used to work out which systems can run at the same time.
+struct SystemAccess
+{
+	std::vector<ComponentTypeID> reads;
+	std::vector<ComponentTypeID> writes;
+	bool declared{ false }; //Systems that haven't declared anything are assumed to touch everything.
+	bool main_thread{ true };
+
+	bool ConflictsWith(const SystemAccess& other) const;
+};
+
+/*
+	Systems which declare the components they read and write (in their constructor or Initialize) can run
+	on any thread, at the same time as other systems they don't conflict with. Systems which don't declare
+	anything - UI, input, anything else touching global state - run on the main thread, with nothing else 
+	running, in the order they were added. Conflicting systems also keep the order they were added in.
+*/
 class System
 {
 public:
@@ -15,6 +37,40 @@ public:
 	virtual void FixedUpdate() {};
 	virtual void Update(double delta_time) {};
 	virtual void LateUpdate() {};
+
+	inline const SystemAccess& GetAccess() const { return access_; }
+
+protected:
+	template<typename T>
+	void Reads()
+	{
+		access_.reads.push_back(GetComponentTypeID<T>());
+		DeclareAccess();
+	}
+
+	template<typename T>
+	void Writes()
+	{
+		access_.writes.push_back(GetComponentTypeID<T>());
+		DeclareAccess();
+	}
+
+	//For a system that only uses the components it declared, but still has to run on the main thread (e.g. it makes ImGui calls).
+	inline void RequireMainThread()
+	{
+		access_.main_thread = true;
+	}
+
+private:
+	inline void DeclareAccess()
+	{
+		if (!access_.declared) {
+			access_.declared = true;
+			access_.main_thread = false;
+		}
+	}
+
+	SystemAccess access_;
 };
 
 void AddSystem(System*);
@@ -22,4 +78,4 @@ void Run();
 void Quit();
 
 }//namespace ecs
-}//namespace rkg
\ No newline at end of file
+}//namespace rkg
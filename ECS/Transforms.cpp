@@ -0,0 +1,269 @@
+#include "Transforms.h"
+
+#include <xmmintrin.h>
+
+#include "ECS/JobSystem.h"
+
+namespace rkg
+{
+namespace ecs
+{
+
+namespace {
+	//result = lhs * rhs for column major matrices, a column at a time with SSE.
+	inline void MultiplyMat4(const Mat4& lhs, const Mat4& rhs, Mat4* result)
+	{
+		const __m128 c0 = _mm_loadu_ps(&lhs.data[0]);
+		const __m128 c1 = _mm_loadu_ps(&lhs.data[4]);
+		const __m128 c2 = _mm_loadu_ps(&lhs.data[8]);
+		const __m128 c3 = _mm_loadu_ps(&lhs.data[12]);
+		for (int i = 0; i < 4; i++) {
+			const float* column = &rhs.data[4 * i];
+			__m128 x = _mm_mul_ps(c0, _mm_set1_ps(column[0]));
+			x = _mm_add_ps(x, _mm_mul_ps(c1, _mm_set1_ps(column[1])));
+			x = _mm_add_ps(x, _mm_mul_ps(c2, _mm_set1_ps(column[2])));
+			x = _mm_add_ps(x, _mm_mul_ps(c3, _mm_set1_ps(column[3])));
+			_mm_storeu_ps(&result->data[4 * i], x);
+		}
+	}
+}
+
+constexpr uint32_t TransformHierarchy::NO_NODE;
+
+uint32_t TransformHierarchy::Find(EntityID id) const
+{
+	uint32_t index = GetEntityIndex(id);
+	if (index >= lookup_.size()) {
+		return NO_NODE;
+	}
+	uint32_t i = lookup_[index];
+	if (i == NO_NODE || entities_[i] != id || removed_[i]) {
+		return NO_NODE;
+	}
+	return i;
+}
+
+bool TransformHierarchy::Contains(EntityID id) const
+{
+	return Find(id) != NO_NODE;
+}
+
+void TransformHierarchy::Add(EntityID id, EntityID parent, const LocalTransform& local)
+{
+	const uint32_t parent_node = (parent == INVALID_ENTITY) ? NO_NODE : Find(parent);
+	Expects(Find(id) == NO_NODE && "Entity is already in the hierarchy.");
+	Expects((parent == INVALID_ENTITY || parent_node != NO_NODE) && "Parent isn't in the hierarchy.");
+
+	uint32_t index = GetEntityIndex(id);
+	if (index >= lookup_.size()) {
+		lookup_.resize(index + 1, NO_NODE);
+	}
+	lookup_[index] = static_cast<uint32_t>(entities_.size());
+
+	entities_.push_back(id);
+	parent_ids_.push_back(parent);
+	parents_.push_back(parent_node);
+	positions_.push_back(local.position);
+	rotations_.push_back(local.rotation);
+	scales_.push_back(local.scale);
+	worlds_.push_back(Mat4::Identity);
+	dirty_.push_back(1);
+	updated_.push_back(0);
+	removed_.push_back(0);
+	order_dirty_ = true;
+}
+
+void TransformHierarchy::Remove(EntityID id)
+{
+	uint32_t i = Find(id);
+	if (i == NO_NODE) {
+		return;
+	}
+	removed_[i] = 1;
+	order_dirty_ = true;
+}
+
+void TransformHierarchy::SetParent(EntityID id, EntityID parent)
+{
+	uint32_t i = Find(id);
+	Expects(i != NO_NODE);
+	//Make sure this doesn't create a cycle.
+	for (EntityID ancestor = parent; ancestor != INVALID_ENTITY; ancestor = parent_ids_[Find(ancestor)]) {
+		Expects(Find(ancestor) != NO_NODE && "Parent isn't in the hierarchy.");
+		Expects(ancestor != id && "Can't parent a node to one of its descendants.");
+	}
+	parent_ids_[i] = parent;
+	parents_[i] = (parent == INVALID_ENTITY) ? NO_NODE : Find(parent);
+	dirty_[i] = 1;
+	order_dirty_ = true;
+}
+
+void TransformHierarchy::SetLocal(EntityID id, const LocalTransform& local)
+{
+	uint32_t i = Find(id);
+	Expects(i != NO_NODE);
+	positions_[i] = local.position;
+	rotations_[i] = local.rotation;
+	scales_[i] = local.scale;
+	dirty_[i] = 1;
+}
+
+LocalTransform TransformHierarchy::GetLocal(EntityID id) const
+{
+	uint32_t i = Find(id);
+	Expects(i != NO_NODE);
+	LocalTransform local;
+	local.position = positions_[i];
+	local.rotation = rotations_[i];
+	local.scale = scales_[i];
+	return local;
+}
+
+const Mat4* TransformHierarchy::GetWorld(EntityID id) const
+{
+	uint32_t i = Find(id);
+	return i != NO_NODE ? &worlds_[i] : nullptr;
+}
+
+void TransformHierarchy::Clear()
+{
+	for (auto id : entities_) {
+		lookup_[GetEntityIndex(id)] = NO_NODE;
+	}
+	entities_.clear();
+	parent_ids_.clear();
+	parents_.clear();
+	positions_.clear();
+	rotations_.clear();
+	scales_.clear();
+	worlds_.clear();
+	dirty_.clear();
+	updated_.clear();
+	removed_.clear();
+	level_starts_.clear();
+	order_dirty_ = false;
+}
+
+void TransformHierarchy::Reorder()
+{
+	//Link up children, then walk the trees breadth first to get the new order.
+	//Nodes which were removed, or are below a removed node, aren't reached and get dropped.
+	const uint32_t count = static_cast<uint32_t>(entities_.size());
+	std::vector<uint32_t> first_child(count, NO_NODE);
+	std::vector<uint32_t> next_sibling(count, NO_NODE);
+	std::vector<uint32_t> order;
+	order.reserve(count);
+	//Children are linked through parents_ rather than by looking up the parent's id, which could 
+	//belong to a node added (or re-added) after the parent was removed.
+	for (uint32_t i = count; i-- > 0;) {
+		if (removed_[i] || parents_[i] == NO_NODE) {
+			continue;
+		}
+		uint32_t parent = parents_[i];
+		next_sibling[i] = first_child[parent];
+		first_child[parent] = i;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		if (!removed_[i] && parents_[i] == NO_NODE) {
+			order.push_back(i);
+		}
+	}
+
+	level_starts_.clear();
+	level_starts_.push_back(0);
+	for (size_t level_begin = 0; level_begin < order.size();) {
+		const size_t level_end = order.size();
+		for (size_t k = level_begin; k < level_end; k++) {
+			const uint32_t node = order[k];
+			for (uint32_t child = first_child[node]; child != NO_NODE; child = next_sibling[child]) {
+				order.push_back(child);
+			}
+		}
+		level_starts_.push_back(level_end);
+		level_begin = level_end;
+	}
+
+	//Permute every array into the new order.
+	std::vector<uint32_t> new_position(count, NO_NODE);
+	for (uint32_t k = 0; k < order.size(); k++) {
+		new_position[order[k]] = k;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		if (new_position[i] == NO_NODE) {
+			lookup_[GetEntityIndex(entities_[i])] = NO_NODE;
+		}
+	}
+
+	auto permute = [&order](auto& array) {
+		std::remove_reference_t<decltype(array)> result;
+		result.reserve(order.size());
+		for (auto i : order) {
+			result.push_back(array[i]);
+		}
+		array.swap(result);
+	};
+	permute(entities_);
+	permute(parent_ids_);
+	permute(positions_);
+	permute(rotations_);
+	permute(scales_);
+	permute(worlds_);
+	permute(dirty_);
+	permute(updated_);
+	permute(removed_);
+	permute(parents_);
+
+	for (uint32_t k = 0; k < order.size(); k++) {
+		lookup_[GetEntityIndex(entities_[k])] = k;
+		if (parents_[k] != NO_NODE) {
+			parents_[k] = new_position[parents_[k]];
+		}
+	}
+	order_dirty_ = false;
+}
+
+void TransformHierarchy::UpdateRange(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++) {
+		const uint32_t parent = parents_[i];
+		const bool parent_updated = parent != NO_NODE && updated_[parent];
+		if (!dirty_[i] && !parent_updated) {
+			updated_[i] = 0;
+			continue;
+		}
+		Mat4 local = TRSMatrix(positions_[i], rotations_[i], scales_[i]);
+		if (parent == NO_NODE) {
+			worlds_[i] = local;
+		}
+		else {
+			MultiplyMat4(worlds_[parent], local, &worlds_[i]);
+		}
+		dirty_[i] = 0;
+		updated_[i] = 1;
+	}
+}
+
+void TransformHierarchy::UpdateWorldTransforms()
+{
+	if (order_dirty_) {
+		Reorder();
+	}
+
+	//Each level only reads from the one above it, so a level's nodes can all be done at once.
+	for (size_t level = 0; level + 1 < level_starts_.size(); level++) {
+		const size_t begin = level_starts_[level];
+		const size_t end = level_starts_[level + 1];
+		if (end - begin < MIN_PARALLEL_LEVEL_SIZE) {
+			UpdateRange(begin, end);
+			continue;
+		}
+		auto job = ParallelFor(end - begin, MIN_PARALLEL_LEVEL_SIZE / 8, [this, begin](size_t i) {
+			UpdateRange(begin + i, begin + i + 1);
+		});
+		SubmitJob(job);
+		Wait(job);
+	}
+}
+
+} //end namespace ecs;
+} //end namespace rkg;
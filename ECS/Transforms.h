@@ -0,0 +1,80 @@
+#pragma once
+#include <vector>
+
+#include "ECS/Entities.h"
+#include "Utilities/Geometry.h"
+
+namespace rkg
+{
+namespace ecs
+{
+
+struct LocalTransform
+{
+	Vec3 position{ 0.0f, 0.0f, 0.0f };
+	Quat rotation{ Quat::Identity };
+	Vec3 scale{ 1.0f, 1.0f, 1.0f };
+};
+
+/*
+	Parent/child transforms for entities. Nodes are stored in breadth first order (all of depth 0, then all of
+	depth 1, ...), SoA, so every parent comes before its children, and each depth level can be updated in
+	parallel once the one above it is done.
+	Setting a local transform marks the node dirty. UpdateWorldTransforms recomputes world matrices for dirty
+	nodes and everything below them, and nothing else.
+	Adding, removing and reparenting nodes only takes effect (re-sorting the arrays) at the next
+	UpdateWorldTransforms. Removing a node removes everything below it as well.
+*/
+class TransformHierarchy
+{
+public:
+	void Add(EntityID id, EntityID parent = INVALID_ENTITY, const LocalTransform& local = LocalTransform());
+	void Remove(EntityID id);
+	//Pass INVALID_ENTITY to make the node a root.
+	void SetParent(EntityID id, EntityID parent);
+	bool Contains(EntityID id) const;
+
+	void SetLocal(EntityID id, const LocalTransform& local);
+	LocalTransform GetLocal(EntityID id) const;
+	//As of the last UpdateWorldTransforms.
+	const Mat4* GetWorld(EntityID id) const;
+
+	//Runs through the job system, so call it from a thread in the pool.
+	void UpdateWorldTransforms();
+
+	//Breadth first arrays, for walking every node. World matrices are as of the last UpdateWorldTransforms.
+	inline size_t Size() const { return entities_.size(); }
+	inline const EntityID* GetEntities() const { return entities_.data(); }
+	inline const Mat4* GetWorldMatrices() const { return worlds_.data(); }
+	//Whether the i'th world matrix changed in the last UpdateWorldTransforms (e.g. to only send moved meshes to the renderer).
+	inline bool WasUpdated(size_t i) const { return updated_[i] != 0; }
+	inline size_t GetNumLevels() const { return level_starts_.empty() ? 0 : level_starts_.size() - 1; }
+
+	void Clear();
+
+private:
+	static constexpr uint32_t NO_NODE{ UINT32_MAX };
+	//Levels smaller than this are updated on the calling thread - not worth the jobs.
+	static constexpr size_t MIN_PARALLEL_LEVEL_SIZE{ 2048 };
+
+	std::vector<EntityID> entities_;
+	std::vector<EntityID> parent_ids_;
+	std::vector<uint32_t> parents_; //Position of the parent node, or NO_NODE for roots.
+	std::vector<Vec3> positions_;
+	std::vector<Quat> rotations_;
+	std::vector<Vec3> scales_;
+	std::vector<Mat4> worlds_;
+	std::vector<uint8_t> dirty_;
+	std::vector<uint8_t> updated_;
+	std::vector<uint8_t> removed_;
+	std::vector<size_t> level_starts_; //Where each depth level begins, plus the end.
+	std::vector<uint32_t> lookup_; //Node position, indexed by entity index.
+	bool order_dirty_{ false };
+
+	uint32_t Find(EntityID id) const;
+	void Reorder();
+	void UpdateRange(size_t begin, size_t end);
+};
+
+} //end namespace ecs;
+} //end namespace rkg;
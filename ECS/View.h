@@ -0,0 +1,160 @@
+#pragma once
+#include <tuple>
+#include <utility>
+
+#include "ECS/Entities.h"
+#include "ECS/JobSystem.h"
+
+namespace rkg
+{
+namespace ecs
+{
+
+/*
+	Iterates over the entities which have a component in every one of a set of ComponentContainers:
+		auto view = MakeView(transforms, velocities, meshes);
+		view.ForEach([](Transform& t, Velocity& v, Mesh& m) { ... });
+	or with a range-based for, which yields std::tuple<Transform&, Velocity&, Mesh&>.
+	Iteration walks the packed array of whichever container is smallest when the view is made, and looks each
+	entity up in the others, so the cost depends on the rarest component rather than the most common one.
+	Containers mustn't have components created or removed while a view is iterating over them.
+*/
+template<typename... Containers>
+class View
+{
+public:
+	static_assert(sizeof...(Containers) > 0, "A view needs at least one container.");
+
+	using Tuple = std::tuple<typename Containers::ValueType&...>;
+	using Pointers = std::tuple<typename Containers::ValueType*...>;
+
+	class Iterator
+	{
+	public:
+		inline Iterator(const View* view, size_t i) : view_{ view }, i_{ i } { Advance(); }
+		inline Tuple operator*() const { return Dereference(Indices{}); }
+		inline Iterator& operator++() { i_++; Advance(); return *this; }
+		inline bool operator!=(const Iterator& other) const { return i_ != other.i_; }
+		inline bool operator==(const Iterator& other) const { return i_ == other.i_; }
+	private:
+		const View* view_;
+		size_t i_;
+		Pointers current_;
+
+		inline void Advance()
+		{
+			const size_t count = view_->SizeHint();
+			while (i_ < count && !view_->Find(i_, &current_)) {
+				i_++;
+			}
+		}
+
+		template<size_t... Is>
+		inline Tuple Dereference(std::index_sequence<Is...>) const
+		{
+			return Tuple(*std::get<Is>(current_)...);
+		}
+	};
+
+	explicit View(Containers&... containers)
+		: containers_{ &containers... }
+	{
+		const size_t sizes[] = { containers.Size()... };
+		for (size_t i = 1; i < sizeof...(Containers); i++) {
+			if (sizes[i] < sizes[driver_]) {
+				driver_ = i;
+			}
+		}
+	}
+
+	//Number of entities the view checks - an upper bound on the number it finds.
+	inline size_t SizeHint() const { return DriverSize(Indices{}); }
+
+	//Calls fn(A&, B&, ...) for each entity which has all the components, in the order the containers were given.
+	template<typename Fn>
+	void ForEach(Fn&& fn) const
+	{
+		const size_t count = SizeHint();
+		Pointers components;
+		for (size_t i = 0; i < count; i++) {
+			if (Find(i, &components)) {
+				Call(fn, components, Indices{});
+			}
+		}
+	}
+
+	//ForEach, split across the job system with ParallelFor. Returns the root job, which still has to be submitted.
+	//fn is called concurrently, so it shouldn't write to anything besides the components it's given.
+	template<typename Fn>
+	Job* ParallelForEach(const Fn& fn, size_t batch_size = AUTO_BATCH_SIZE) const
+	{
+		const View view = *this;
+		return ParallelFor(SizeHint(), batch_size, [view, fn](size_t i) {
+			Pointers components;
+			if (view.Find(i, &components)) {
+				Call(fn, components, Indices{});
+			}
+		});
+	}
+
+	inline Iterator begin() const { return Iterator(this, 0); }
+	inline Iterator end() const { return Iterator(this, SizeHint()); }
+
+private:
+	using Indices = std::index_sequence_for<Containers...>;
+
+	std::tuple<Containers*...> containers_;
+	size_t driver_{ 0 };
+
+	//Finds the components for the i'th entity of the driving container. Returns false if it's missing any of them.
+	inline bool Find(size_t i, Pointers* components) const
+	{
+		return Find(i, components, Indices{});
+	}
+
+	template<size_t... Is>
+	inline size_t DriverSize(std::index_sequence<Is...>) const
+	{
+		const size_t sizes[] = { std::get<Is>(containers_)->Size()... };
+		return sizes[driver_];
+	}
+
+	template<size_t... Is>
+	inline bool Find(size_t i, Pointers* components, std::index_sequence<Is...>) const
+	{
+		EntityID id = INVALID_ENTITY;
+		const int unused[] = { (Is == driver_ ? (id = std::get<Is>(containers_)->At(i).entity_id, 0) : 0)... };
+		(void)unused;
+
+		*components = Pointers(Lookup<Is>(id, i)...);
+		const bool found[] = { (std::get<Is>(*components) != nullptr)... };
+		for (bool f : found) {
+			if (!f) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	template<size_t I>
+	inline auto Lookup(EntityID id, size_t i) const
+	{
+		auto container = std::get<I>(containers_);
+		return I == driver_ ? &container->At(i) : container->Get(id);
+	}
+
+	template<typename Fn, size_t... Is>
+	static inline void Call(Fn& fn, const Pointers& components, std::index_sequence<Is...>)
+	{
+		fn(*std::get<Is>(components)...);
+	}
+};
+
+template<typename... Containers>
+View<Containers...> MakeView(Containers&... containers)
+{
+	return View<Containers...>(containers...);
+}
+
+} //end namespace ecs;
+} //end namespace rkg;
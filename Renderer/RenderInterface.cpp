@@ -4,6 +4,7 @@
 #include "Utilities/HashIndex.h"
 #include "External/GLFW/glfw3.h"
 #include "Renderer.h"
+#include "ECS/JobSystem.h"
 #include <atomic>
 #include <thread>
 #include <vector>
@@ -272,6 +273,7 @@ void ForwardRendererPrototype()
 			This shader runs for each light and computes a cluster list, where each element of this cluster list has an offset and count into an item list, which stores actual light indices.
 			This may not be as easily parallelized as I thought - computing the counts can be easily done using atomics, but offsets needs a prefix scan, and the item list needs to be sorted. So probably better done on the CPU.
 			May be easier to just do this computation serially. 
+			On the CPU, ParallelInclusiveScan (offsets) and ParallelSort (item list) in ECS/ParallelAlgorithms.h cover this.
 		2. Optional: Depth pre-pass. Avoids overdraw, so probably worthwhile. Also outputs a velocity buffer - probably won't bother with that for a while.
 		3. Forward pass: For each mesh, draw it to the frame buffer. Do lighting lookups here, etc.
 		For now, this would even be enough for me. I can probably do everything here in a single pass, but maybe not IBL. If I need to, I can do that afterwards.
@@ -295,6 +297,7 @@ void ForwardRendererPrototype()
 void RenderLoop(GLFWwindow* window)
 {
 	gl::InitializeBackend(window);
+	ecs::RegisterPinnedThread(ecs::JobThread::RENDER); //Jobs that need the GL context get run here.
 
 	//Set up framegraph in here.
 	FrameGraph frame_graph;
@@ -309,6 +312,7 @@ void RenderLoop(GLFWwindow* window)
 
 	while (true) {
 		while (render_fence.test_and_set(std::memory_order_acquire)) {
+			ecs::RunPinnedJobs(ecs::JobThread::RENDER); //The game thread may be waiting on one of these.
 			std::this_thread::yield();
 		} //Spin while this flag hasn't been set by the other thread.
 		render_commands.SwapBuffers(); //Need to signal to the other threads that they can now make render calls.
@@ -318,6 +322,7 @@ void RenderLoop(GLFWwindow* window)
 		std::swap(debug_front_data_buffer,  debug_back_data_buffer);
 		debug_back_data_buffer->clear();
 		debug_back_index_buffer->clear();
+		ecs::RunPinnedJobs(ecs::JobThread::RENDER); //Must be done before the game thread clears the job allocators.
 		game_fence.clear();
 
 		//Update our state by pumping the command list. This syncs state between the game + render threads.
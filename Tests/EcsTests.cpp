@@ -0,0 +1,177 @@
+/*
+	Regression tests for the ECS.
+	Each test is a plain function, registered in TESTS below. Failed checks are printed, and the
+	program returns the number of them, so it can run as a post-build step.
+
+	Usage: EcsTests
+*/
+#include <cstdio>
+#include <vector>
+
+#include "ECS/Entities.h"
+#include "ECS/CommandBuffer.h"
+#include "ECS/JobSystem.h"
+#include "ECS/SpatialIndex.h"
+#include "ECS/Transforms.h"
+
+using namespace rkg;
+using namespace rkg::ecs;
+
+namespace
+{
+	int num_failures{ 0 };
+
+#define CHECK(cond) do { if (!(cond)) { std::printf("%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #cond); num_failures++; } } while (0)
+
+	//A removed node's children must not be picked up by whatever is added at its entity index before the next update.
+	void TestRemovedParentIndexReused()
+	{
+		const EntityID a = MakeEntityID(0, 0);
+		const EntityID b = MakeEntityID(0, 1);
+		const EntityID c = MakeEntityID(1, 0);
+
+		TransformHierarchy transforms;
+		transforms.Add(a);
+		transforms.Add(c, a);
+		transforms.UpdateWorldTransforms();
+		transforms.Remove(a);
+		transforms.Add(b);
+		transforms.UpdateWorldTransforms();
+
+		CHECK(transforms.Size() == 1);
+		CHECK(transforms.Contains(b));
+		CHECK(!transforms.Contains(c));
+	}
+
+	void TestRemovedParentReadded()
+	{
+		const EntityID a = MakeEntityID(0, 0);
+		const EntityID c = MakeEntityID(1, 0);
+
+		TransformHierarchy transforms;
+		transforms.Add(a);
+		transforms.Add(c, a);
+		transforms.UpdateWorldTransforms();
+		transforms.Remove(a);
+		transforms.Add(a);
+		transforms.UpdateWorldTransforms();
+
+		CHECK(transforms.Size() == 1);
+		CHECK(transforms.Contains(a));
+		CHECK(!transforms.Contains(c));
+	}
+
+	//Bounds which grow without moving the entity to another cell must still be found from nearby cells.
+	void TestBoundsGrowInPlace()
+	{
+		SpatialIndex index(8.0f);
+		//Enough other cells that a small query only visits the cells around it.
+		for (uint32_t i = 0; i < 200; i++) {
+			const Vec3 center(100.0f + 8.0f * (i % 20), 8.0f * (i / 20), 0.0f);
+			const Vec3 half_size(0.5f, 0.5f, 0.5f);
+			index.Add(MakeEntityID(i, 0), AABB{ center - half_size, center + half_size });
+		}
+		const EntityID big = MakeEntityID(200, 0);
+		index.Add(big, AABB{ Vec3(-1.0f, -1.0f, -1.0f), Vec3(1.0f, 1.0f, 1.0f) });
+		index.SetLocalBounds(big, AABB{ Vec3(-60.0f, -60.0f, -60.0f), Vec3(60.0f, 60.0f, 60.0f) });
+
+		bool found = false;
+		index.QueryAABB(AABB{ Vec3(50.0f, 0.0f, 0.0f), Vec3(51.0f, 1.0f, 1.0f) }, [&found, big](EntityID id) {
+			found = found || id == big;
+		});
+		CHECK(found);
+	}
+
+	//Component assignments in the order playback makes them, to check the order commands are applied in.
+	struct Assignment
+	{
+		int container;
+		uint32_t index;
+		int value;
+	};
+	std::vector<Assignment> assignments;
+
+	template<int Container>
+	struct LoggedComponent : Component
+	{
+		int value{ 0 };
+
+		LoggedComponent() = default;
+		explicit LoggedComponent(int v) : value{ v } {}
+		LoggedComponent(const LoggedComponent&) = default;
+		LoggedComponent(LoggedComponent&&) = default;
+		LoggedComponent& operator=(const LoggedComponent&) = default;
+		LoggedComponent& operator=(LoggedComponent&& other)
+		{
+			value = other.value;
+			assignments.push_back({ Container, GetEntityIndex(entity_id), value });
+			return *this;
+		}
+	};
+
+	//Component changes are applied by container, then entity index, then in recorded order. Destroys go last.
+	void TestCommandPlaybackOrder()
+	{
+		InitializeWorkerThreads(0);
+		{
+			Scene scene;
+			ComponentContainer<LoggedComponent<0>> a;
+			ComponentContainer<LoggedComponent<1>> b;
+			const EntityID e0 = scene.CreateEntity()->id;
+			const EntityID e1 = scene.CreateEntity()->id;
+
+			EntityCommandBuffer commands(&scene);
+			commands.AddComponent(b, e1, LoggedComponent<1>(1));
+			commands.DestroyEntity(e0);
+			commands.AddComponent(a, e1, LoggedComponent<0>(2));
+			commands.AddComponent(b, e0, LoggedComponent<1>(3));
+			commands.AddComponent(a, e0, LoggedComponent<0>(4));
+			commands.AddComponent(a, e0, LoggedComponent<0>(5));
+			assignments.clear();
+			commands.Playback();
+
+			//Containers are ordered by address.
+			const std::vector<Assignment> a_changes = { { 0, GetEntityIndex(e0), 4 }, { 0, GetEntityIndex(e0), 5 }, { 0, GetEntityIndex(e1), 2 } };
+			const std::vector<Assignment> b_changes = { { 1, GetEntityIndex(e0), 3 }, { 1, GetEntityIndex(e1), 1 } };
+			std::vector<Assignment> expected;
+			const bool a_first = reinterpret_cast<uintptr_t>(&a) < reinterpret_cast<uintptr_t>(&b);
+			expected.insert(expected.end(), a_first ? a_changes.begin() : b_changes.begin(), a_first ? a_changes.end() : b_changes.end());
+			expected.insert(expected.end(), a_first ? b_changes.begin() : a_changes.begin(), a_first ? b_changes.end() : a_changes.end());
+
+			CHECK(assignments.size() == expected.size());
+			for (size_t i = 0; i < assignments.size() && i < expected.size(); i++) {
+				CHECK(assignments[i].container == expected[i].container);
+				CHECK(assignments[i].index == expected[i].index);
+				CHECK(assignments[i].value == expected[i].value);
+			}
+			CHECK(a.Get(e0) && a.Get(e0)->value == 5);
+			CHECK(!scene.IsAlive(e0));
+			CHECK(scene.IsAlive(e1));
+		}
+		ShutdownWorkerThreads();
+	}
+
+	struct Test
+	{
+		const char* name;
+		void(*fn)();
+	};
+
+	const Test TESTS[] = {
+		{ "TransformHierarchy: removed parent, index reused", TestRemovedParentIndexReused },
+		{ "TransformHierarchy: removed parent, re-added", TestRemovedParentReadded },
+		{ "SpatialIndex: bounds grown in place", TestBoundsGrowInPlace },
+		{ "EntityCommandBuffer: playback order", TestCommandPlaybackOrder },
+	};
+}
+
+int main(int, char**)
+{
+	for (const auto& test : TESTS) {
+		const int failures_before = num_failures;
+		test.fn();
+		std::printf("%s: %s\n", num_failures == failures_before ? "passed" : "FAILED", test.name);
+	}
+	std::printf("%d check(s) failed\n", num_failures);
+	return num_failures;
+}
@@ -393,6 +393,40 @@ public:
 	}
 };
 
+/*
+	Like Mallocator, but every block starts on the given alignment.
+	Blocks must be freed through this allocator, not free().
+*/
+template<size_t Alignment>
+class AlignedMallocator
+{
+public:
+	static constexpr unsigned int ALIGNMENT = Alignment;
+
+	MemoryBlock Allocate(size_t n)
+	{
+		void* ptr = _aligned_malloc(n, Alignment);
+		if (!ptr) {
+			return{ nullptr, 0 };
+		}
+		return{ ptr, n };
+	}
+
+	void Deallocate(MemoryBlock b)
+	{
+		_aligned_free(b.ptr);
+	}
+
+	void Reallocate(MemoryBlock& b, size_t new_size)
+	{
+		auto ptr = _aligned_realloc(b.ptr, new_size, Alignment);
+		if (ptr) {
+			b.ptr = ptr;
+			b.length = new_size;
+		}
+	}
+};
+
 template<size_t MaximumSize>
 class GrowingLinearAllocator
 {
@@ -437,14 +471,15 @@ public:
 		size_t size_to_allocate = RoundToAligned(size, ALIGNMENT);
 
 		if (physical_memory_current_ + size_to_allocate > physical_memory_end_) {
-			//Allocate a new page. 
+			//Allocate enough new pages to fit the block - it may be bigger than one page.
+			const size_t size_to_commit = RoundToAligned(physical_memory_current_ + size_to_allocate - physical_memory_end_, virtual_memory::PAGE_SIZE);
 
-			if (physical_memory_end_ + virtual_memory::PAGE_SIZE > virtual_memory_end_) {
+			if (physical_memory_end_ + size_to_commit > virtual_memory_end_) {
 				return MemoryBlock{ nullptr, 0 };
 			}
 
-			virtual_memory::AllocatePhysicalMemory(physical_memory_end_, virtual_memory::PAGE_SIZE);
-			physical_memory_end_ += virtual_memory::PAGE_SIZE;
+			virtual_memory::AllocatePhysicalMemory(physical_memory_end_, size_to_commit);
+			physical_memory_end_ += size_to_commit;
 		}
 		
 
@@ -459,10 +494,12 @@ public:
 		ASSERT(false);
 	}
 
-	inline void Deallocate(MemoryBlock)
+	//Only the most recent allocation can actually be given back. Anything else stays used until DeallocateAll.
+	inline void Deallocate(MemoryBlock b)
 	{
-		//TODO:
-		ASSERT(false);
+		if (static_cast<char*>(b.ptr) + b.length == physical_memory_current_) {
+			physical_memory_current_ = static_cast<char*>(b.ptr);
+		}
 	}
 
 	inline void DeallocateAll()
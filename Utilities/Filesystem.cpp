@@ -69,4 +69,57 @@ namespace rkg
 #error "Filesystem not supported on this platform."
 #endif
 	}
-}
\ No newline at end of file
+
+	MappedFile MapFile(const char* path)
+	{
+#ifdef _WIN32
+		MappedFile result;
+		auto file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return result;
+		}
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+			CloseHandle(file);
+			return result;
+		}
+
+		auto mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping) {
+			CloseHandle(file);
+			return result;
+		}
+
+		auto data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!data) {
+			CloseHandle(mapping);
+			CloseHandle(file);
+			return result;
+		}
+
+		result.data = data;
+		result.size = static_cast<size_t>(size.QuadPart);
+		result.file_handle = file;
+		result.mapping_handle = mapping;
+		return result;
+#else
+#error "Filesystem not supported on this platform."
+#endif
+	}
+
+	void UnmapFile(MappedFile& file)
+	{
+#ifdef _WIN32
+		if (file.data) {
+			UnmapViewOfFile(file.data);
+			CloseHandle(file.mapping_handle);
+			CloseHandle(file.file_handle);
+		}
+		file = MappedFile();
+#else
+#error "Filesystem not supported on this platform."
+#endif
+	}
+}
@@ -30,4 +30,16 @@ namespace rkg
 	const char* GetFileExtension(const char* path, int len);
 
 	time_t GetFileEditedTime(const char* path);//Returns time that the file was last edited/modified.
+
+	//A whole file mapped read-only into memory, so it can be read without copying it into a buffer first.
+	struct MappedFile
+	{
+		const void* data{ nullptr }; //nullptr if the file couldn't be mapped.
+		size_t size{ 0 };
+		void* file_handle{ nullptr };
+		void* mapping_handle{ nullptr };
+	};
+
+	MappedFile MapFile(const char* path);
+	void UnmapFile(MappedFile& file);
 }
\ No newline at end of file
@@ -9,3 +9,5 @@ const rkg::Mat4 rkg::Mat4::Identity{ Vec4(1.0,0.0,0.0,0.0),
 									 Vec4(0.0,0.0,1.0,0.0),
 									 Vec4(0.0,0.0,0.0,1.0) };
 
+const rkg::Quat rkg::Quat::Identity{ 0.0f, 0.0f, 0.0f, 1.0f };
+
@@ -551,4 +551,183 @@ namespace rkg {
 
 	};
 
+	//Unit quaternion, for rotations.
+	struct Quat
+	{
+		float x, y, z, w;
+
+		static const Quat Identity;
+		Quat() = default;
+		Quat(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+
+		//Rotation by angle (radians) around a unit length axis.
+		inline static Quat AxisAngle(const Vec3& axis, float angle)
+		{
+			float s = std::sin(angle * 0.5f);
+			return Quat(axis.x * s, axis.y * s, axis.z * s, std::cos(angle * 0.5f));
+		}
+
+		//Composition - rotates by rhs, then lhs.
+		inline friend Quat operator*(const Quat& lhs, const Quat& rhs)
+		{
+			return Quat(lhs.w * rhs.x + lhs.x * rhs.w + lhs.y * rhs.z - lhs.z * rhs.y,
+						lhs.w * rhs.y - lhs.x * rhs.z + lhs.y * rhs.w + lhs.z * rhs.x,
+						lhs.w * rhs.z + lhs.x * rhs.y - lhs.y * rhs.x + lhs.z * rhs.w,
+						lhs.w * rhs.w - lhs.x * rhs.x - lhs.y * rhs.y - lhs.z * rhs.z);
+		}
+
+		inline friend Quat Normalize(const Quat& q)
+		{
+			float l = std::sqrt(q.x*q.x + q.y*q.y + q.z*q.z + q.w*q.w);
+			return Quat(q.x / l, q.y / l, q.z / l, q.w / l);
+		}
+	};
+
+	//Matrix which scales, then rotates, then translates.
+	inline Mat4 TRSMatrix(const Vec3& t, const Quat& r, const Vec3& s)
+	{
+		const float xx = r.x * r.x, yy = r.y * r.y, zz = r.z * r.z;
+		const float xy = r.x * r.y, xz = r.x * r.z, yz = r.y * r.z;
+		const float wx = r.w * r.x, wy = r.w * r.y, wz = r.w * r.z;
+		return Mat4(Vec4((1 - 2 * (yy + zz)) * s.x, 2 * (xy + wz) * s.x, 2 * (xz - wy) * s.x, 0),
+					Vec4(2 * (xy - wz) * s.y, (1 - 2 * (xx + zz)) * s.y, 2 * (yz + wx) * s.y, 0),
+					Vec4(2 * (xz + wy) * s.z, 2 * (yz - wx) * s.z, (1 - 2 * (xx + yy)) * s.z, 0),
+					Vec4(t.x, t.y, t.z, 1));
+	}
+
+	//Axis aligned bounding box.
+	struct AABB
+	{
+		Vec3 min;
+		Vec3 max;
+
+		inline Vec3 Center() const { return (min + max) * 0.5f; }
+		inline Vec3 Extents() const { return (max - min) * 0.5f; }
+
+		inline friend bool Overlaps(const AABB& a, const AABB& b)
+		{
+			return a.min.x <= b.max.x && a.max.x >= b.min.x
+				&& a.min.y <= b.max.y && a.max.y >= b.min.y
+				&& a.min.z <= b.max.z && a.max.z >= b.min.z;
+		}
+
+		inline friend AABB Union(const AABB& a, const AABB& b)
+		{
+			return AABB{ Min(a.min, b.min), Max(a.max, b.max) };
+		}
+	};
+
+	//Bounds of the box after transforming it, still axis aligned (so possibly larger than the box itself).
+	inline AABB TransformAABB(const Mat4& m, const AABB& box)
+	{
+		const Vec3 center = box.Center();
+		const Vec3 extents = box.Extents();
+		Vec3 new_center(m[12], m[13], m[14]);
+		Vec3 new_extents(0.0f, 0.0f, 0.0f);
+		for (unsigned int row = 0; row < 3; row++) {
+			float c = 0.0f, e = 0.0f;
+			for (unsigned int col = 0; col < 3; col++) {
+				c += m(row, col) * (&center.x)[col];
+				e += std::abs(m(row, col)) * (&extents.x)[col];
+			}
+			(&new_center.x)[row] += c;
+			(&new_extents.x)[row] = e;
+		}
+		return AABB{ new_center - new_extents, new_center + new_extents };
+	}
+
+	struct Sphere
+	{
+		Vec3 center;
+		float radius;
+	};
+
+	inline bool Overlaps(const Sphere& s, const AABB& box)
+	{
+		const Vec3 d = s.center - Clamp(s.center, box.min, box.max);
+		return Dot(d, d) <= s.radius * s.radius;
+	}
+
+	//direction doesn't have to be normalized, but distances along the ray are in units of its length.
+	struct Ray
+	{
+		Vec3 origin;
+		Vec3 direction;
+	};
+
+	//Distance along the ray to where it enters the box (0 if it starts inside), or a negative number if it misses.
+	inline float Intersect(const Ray& ray, const AABB& box, float max_distance = std::numeric_limits<float>::max())
+	{
+		float t_min = 0.0f, t_max = max_distance;
+		for (int axis = 0; axis < 3; axis++) {
+			const float origin = (&ray.origin.x)[axis];
+			const float direction = (&ray.direction.x)[axis];
+			const float lo = (&box.min.x)[axis];
+			const float hi = (&box.max.x)[axis];
+			if (direction == 0.0f) {
+				if (origin < lo || origin > hi) {
+					return -1.0f;
+				}
+				continue;
+			}
+			float t0 = (lo - origin) / direction;
+			float t1 = (hi - origin) / direction;
+			if (t0 > t1) {
+				std::swap(t0, t1);
+			}
+			t_min = std::max(t_min, t0);
+			t_max = std::min(t_max, t1);
+			if (t_min > t_max) {
+				return -1.0f;
+			}
+		}
+		return t_min;
+	}
+
+	//Six planes (xyz = normal pointing inwards, w = distance), as ax + by + cz + d >= 0 for points inside.
+	struct Frustum
+	{
+		Vec4 planes[6];
+
+		//Extracts the planes from a (column major, OpenGL clip space) view-projection matrix.
+		inline static Frustum FromMatrix(const Mat4& m)
+		{
+			Frustum f;
+			for (unsigned int i = 0; i < 3; i++) {
+				for (unsigned int side = 0; side < 2; side++) {
+					const float sign = side == 0 ? 1.0f : -1.0f;
+					Vec4 p(m(3, 0) + sign * m(i, 0), m(3, 1) + sign * m(i, 1), m(3, 2) + sign * m(i, 2), m(3, 3) + sign * m(i, 3));
+					const float length = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+					f.planes[2 * i + side] = p / length;
+				}
+			}
+			return f;
+		}
+	};
+
+	//Conservative - boxes near the frustum's corners can pass without actually being inside.
+	inline bool Overlaps(const Frustum& f, const AABB& box)
+	{
+		for (const auto& p : f.planes) {
+			//The corner furthest along the plane's normal.
+			const Vec3 corner(p.x >= 0.0f ? box.max.x : box.min.x,
+							  p.y >= 0.0f ? box.max.y : box.min.y,
+							  p.z >= 0.0f ? box.max.z : box.min.z);
+			if (p.x * corner.x + p.y * corner.y + p.z * corner.z + p.w < 0.0f) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	inline bool Overlaps(const Frustum& f, const Sphere& s)
+	{
+		for (const auto& p : f.planes) {
+			if (p.x * s.center.x + p.y * s.center.y + p.z * s.center.z + p.w < -s.radius) {
+				return false;
+			}
+		}
+		return true;
+	}
+
 }
\ No newline at end of file
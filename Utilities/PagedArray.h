@@ -0,0 +1,162 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <utility>
+#include <cstring>
+#include <cstddef>
+#include <type_traits>
+
+#include "Utilities.h"
+#include "Allocators.h"
+
+namespace rkg
+{
+
+/*
+	Growable array stored in fixed size pages, so elements never move once they're added - pointers to them stay
+	valid until they're popped, and growing never copies what's already there.
+	Pages are kept once allocated (shrinking just destroys elements), and given back in reverse order on destruction,
+	so a GrowingLinearAllocator works as the allocator - the whole array then sits in one reserved range of address
+	space, with physical memory committed as it grows.
+*/
+template<class ElementType, class Allocator = Mallocator, size_t PageShift = 10>
+class PagedArray
+{
+private:
+	using element_type = ElementType;
+	static_assert(alignof(element_type) <= alignof(std::max_align_t), "Pages are only aligned to max_align_t.");
+
+	std::vector<element_type*> pages_;
+	size_t size_{ 0 };
+	Allocator allocator_{};
+
+	inline void AddPage()
+	{
+		auto block = allocator_.Allocate(PAGE_BYTES);
+		ASSERT(block.ptr && "Out of memory for pages.");
+		pages_.push_back(static_cast<element_type*>(block.ptr));
+	}
+
+public:
+	static constexpr size_t PAGE_SIZE{ size_t(1) << PageShift }; //In elements.
+	static constexpr size_t PAGE_MASK{ PAGE_SIZE - 1 };
+	static constexpr size_t PAGE_BYTES{ PAGE_SIZE * sizeof(element_type) };
+
+	template<typename Array, typename Value>
+	class Iterator
+	{
+	public:
+		inline Iterator(Array* array, size_t i) : array_{ array }, i_{ i } {}
+		inline Value& operator*() const { return (*array_)[i_]; }
+		inline Value* operator->() const { return &(*array_)[i_]; }
+		inline Iterator& operator++() { i_++; return *this; }
+		inline bool operator==(const Iterator& other) const { return i_ == other.i_; }
+		inline bool operator!=(const Iterator& other) const { return i_ != other.i_; }
+	private:
+		Array* array_;
+		size_t i_;
+	};
+	using iterator = Iterator<PagedArray, element_type>;
+	using const_iterator = Iterator<const PagedArray, const element_type>;
+
+	PagedArray() = default;
+	PagedArray(const PagedArray&) = delete;
+	PagedArray& operator=(const PagedArray&) = delete;
+
+	~PagedArray()
+	{
+		Clear();
+		for (size_t i = pages_.size(); i-- > 0;) {
+			allocator_.Deallocate(MemoryBlock{ pages_[i], RoundToAligned(PAGE_BYTES, Allocator::ALIGNMENT) });
+		}
+	}
+
+	inline size_t Size() const { return size_; }
+	inline bool Empty() const { return size_ == 0; }
+
+	inline element_type& operator[](size_t i) { return pages_[i >> PageShift][i & PAGE_MASK]; }
+	inline const element_type& operator[](size_t i) const { return pages_[i >> PageShift][i & PAGE_MASK]; }
+	inline element_type& Back() { return (*this)[size_ - 1]; }
+
+	template<typename... Args>
+	inline element_type& Emplace(Args&&... args)
+	{
+		if ((size_ >> PageShift) >= pages_.size()) {
+			AddPage();
+		}
+		element_type* result = new(&(*this)[size_]) element_type(std::forward<Args>(args)...);
+		size_++;
+		return *result;
+	}
+
+	//Adds count copies of value to the end, filling a page at a time.
+	inline void Append(size_t count, const element_type& value)
+	{
+		const size_t end = size_ + count;
+		while (pages_.size() << PageShift < end) {
+			AddPage();
+		}
+		while (size_ < end) {
+			const size_t n = std::min(PAGE_SIZE - (size_ & PAGE_MASK), end - size_);
+			std::uninitialized_fill_n(&(*this)[size_], n, value);
+			size_ += n;
+		}
+	}
+
+	inline void PopBack()
+	{
+		Expects(size_ > 0);
+		size_--;
+		(*this)[size_].~element_type();
+	}
+
+	inline void Clear()
+	{
+		while (size_ > 0) {
+			PopBack();
+		}
+	}
+
+	//Replaces the contents with count elements copied from data, a page at a time.
+	inline void Assign(const element_type* data, size_t count)
+	{
+		static_assert(std::is_trivially_copyable<element_type>::value, "Assign copies bytes, so needs a trivially copyable type.");
+		Clear();
+		while (pages_.size() << PageShift < count) {
+			AddPage();
+		}
+		for (size_t begin = 0; begin < count; begin += PAGE_SIZE) {
+			memcpy(pages_[begin >> PageShift], data + begin, std::min(PAGE_SIZE, count - begin) * sizeof(element_type));
+		}
+		size_ = count;
+	}
+
+	//Calls fn(element_type* data, size_t count) for each page's worth of elements, in order.
+	template<typename Fn>
+	void ForEachRange(Fn&& fn)
+	{
+		for (size_t begin = 0; begin < size_; begin += PAGE_SIZE) {
+			fn(pages_[begin >> PageShift], std::min(PAGE_SIZE, size_ - begin));
+		}
+	}
+
+	template<typename Fn>
+	void ForEachRange(Fn&& fn) const
+	{
+		for (size_t begin = 0; begin < size_; begin += PAGE_SIZE) {
+			fn(static_cast<const element_type*>(pages_[begin >> PageShift]), std::min(PAGE_SIZE, size_ - begin));
+		}
+	}
+
+	inline iterator begin() { return iterator(this, 0); }
+	inline iterator end() { return iterator(this, size_); }
+	inline const_iterator begin() const { return const_iterator(this, 0); }
+	inline const_iterator end() const { return const_iterator(this, size_); }
+};
+
+template<class ElementType, class Allocator, size_t PageShift>
+constexpr size_t PagedArray<ElementType, Allocator, PageShift>::PAGE_SIZE;
+
+} //end namespace rkg
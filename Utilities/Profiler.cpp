@@ -9,6 +9,7 @@
 #include <vector>
 
 #include "External/imgui/imgui.h"
+#include "ECS/JobSystem.h"
 #include "Utilities/Allocators.h"
 #include "Utilities/Utilities.h"
 
@@ -71,6 +72,58 @@ namespace profiler {
 			return 1000.f*duration;
 #endif
 		}
+
+		//Job system counters are cumulative, so keep last frame's values around to show per-frame numbers.
+		std::vector<ecs::WorkerStats> previous_job_stats;
+
+		void DrawJobSystemStats()
+		{
+			const int num_threads = ecs::GetNumJobThreads();
+			previous_job_stats.resize(num_threads, ecs::WorkerStats{});
+			if (!ImGui::CollapsingHeader("Job System")) {
+				//Still take a sample, so opening the panel doesn't show everything since it was last open.
+				for (int i = 0; i < num_threads; i++) {
+					previous_job_stats[i] = ecs::GetWorkerStats(i);
+				}
+				return;
+			}
+
+			ImGui::Columns(8, "job_system_stats");
+			const char* headers[] = { "Thread", "Executed", "Stolen", "Failed steals", "Idle (ms)", "Parked (ms)", "Woken", "Job memory (KB)" };
+			for (const char* header : headers) {
+				ImGui::Text("%s", header);
+				ImGui::NextColumn();
+			}
+			ImGui::Separator();
+
+			for (int i = 0; i < num_threads; i++) {
+				const auto stats = ecs::GetWorkerStats(i);
+				const auto& prev = previous_job_stats[i];
+				if (i == 0) {
+					ImGui::Text("Main");
+				}
+				else {
+					ImGui::Text("Worker %d", i);
+				}
+				ImGui::NextColumn();
+				ImGui::Text("%llu", (unsigned long long)(stats.jobs_executed - prev.jobs_executed));
+				ImGui::NextColumn();
+				ImGui::Text("%llu", (unsigned long long)(stats.jobs_stolen - prev.jobs_stolen));
+				ImGui::NextColumn();
+				ImGui::Text("%llu", (unsigned long long)(stats.failed_steals - prev.failed_steals));
+				ImGui::NextColumn();
+				ImGui::Text("%.3f", (stats.idle_ns - prev.idle_ns) / 1000000.0);
+				ImGui::NextColumn();
+				ImGui::Text("%.3f", (stats.parked_ns - prev.parked_ns) / 1000000.0);
+				ImGui::NextColumn();
+				ImGui::Text("%llu", (unsigned long long)(stats.times_woken - prev.times_woken));
+				ImGui::NextColumn();
+				ImGui::Text("%.1f", stats.last_frame_allocated_bytes / 1024.0);
+				ImGui::NextColumn();
+				previous_job_stats[i] = stats;
+			}
+			ImGui::Columns(1);
+		}
 	}
 
 
@@ -197,6 +250,8 @@ namespace profiler {
 		if (ImGui::Button("Capture Frame")) {
 			CaptureFrame();
 		}
+
+		DrawJobSystemStats();
 		ImGui::End();
 
 		if (capture_next_frame_) {